@@ -1,29 +1,187 @@
 // NumericOverflows.cpp : This file contains the 'main' function. Program execution begins and ends there.
 //
 
+#include <algorithm>    // std::min
+#include <bit>          // std::countr_zero
 #include <iostream>     // std::cout
 #include <limits>       // std::numeric_limits
 #include <cstdlib>
+#include <cmath>        // std::fabs, std::isfinite
+#include <type_traits>  // std::make_unsigned_t, std::is_signed_v
+#include <cstddef>      // std::size_t
+#include <cstdint>      // std::uint64_t
+#include <span>         // std::span
+#include <vector>       // std::vector
 
 bool overflow_flag = false;
 bool underflow_flag = false;
 
+// floating point runs this short are still added one step at a time, so their per-step rounding
+// (and every result the tests print) is unchanged. longer runs are rounded once
+const unsigned long int floating_stepwise_limit = 64;
+
 /// <summary>
-/// Template function to abstract away the logic of:
-///   start + (increment * steps)
+/// What checked_add and checked_subtract give back when not all of the steps fit. The status says
+/// whether they fit under every policy
 /// </summary>
-/// <typeparam name="T">A type that with basic math functions</typeparam>
+enum class overflow_policy
+{
+	// the value after the last step that fit
+	detect,
+	// the end of the range the check guards: max or min for integers, max or zero for floating point
+	saturate,
+	// the value with no check at all: modulo 2^N for integers, the rounded (maybe infinite) sum for
+	// floating point
+	wrap
+};
+
+/// <summary>
+/// The result of a checked_add or checked_subtract, carrying its own status instead of setting
+/// overflow_flag or underflow_flag, so it can be called from any number of threads at once
+/// </summary>
+/// <typeparam name="T">The type the arithmetic was done in</typeparam>
+template <typename T>
+struct checked_result
+{
+	// start moved as the policy says
+	T value;
+	// true if not all of the steps fit
+	bool out_of_range;
+
+	constexpr bool ok() const { return !out_of_range; }
+};
+
+/// <summary>
+/// |value| as the unsigned type of the same width, which holds it even for min()
+/// </summary>
+template <typename T>
+constexpr std::make_unsigned_t<T> magnitude(T const& value)
+{
+	using U = std::make_unsigned_t<T>;
+
+	if constexpr (std::is_signed_v<T>) {
+		if (value < 0) return static_cast<U>(U(0) - static_cast<U>(value));
+	}
+	return static_cast<U>(value);
+}
+
+/// <summary>
+/// Moves start by steps steps of size step, up toward max or down toward min, stopping at the last
+/// step that stays in range. The distance to either end of T's range always fits the unsigned type of
+/// the same width, so this needs no wider type even for 64 bit integers, and takes the same time for
+/// any number of steps
+/// </summary>
+/// <typeparam name="T">An integer type</typeparam>
 /// <param name="start">The number to start with</param>
-/// <param name="increment">How much to add each step</param>
-/// <param name="steps">The number of steps to iterate</param>
-/// <returns>start + (increment * steps)</returns>
+/// <param name="step">The size of each step, as the unsigned type of the same width</param>
+/// <param name="up">true to move toward max, false toward min</param>
+/// <param name="steps">The number of steps to take</param>
+/// <param name="out_of_range">Set to true if not all of the steps fit</param>
+/// <returns>start moved by as many steps as fit</returns>
 template <typename T>
-T add_numbers(T const& start, T const& increment, unsigned long int const& steps)
+constexpr T move_within_range(T const& start, std::make_unsigned_t<T> const& step, bool up, unsigned long int const& steps, bool& out_of_range)
+{
+	using U = std::make_unsigned_t<T>;
+
+	const U room = up ? static_cast<U>(static_cast<U>(std::numeric_limits<T>::max()) - static_cast<U>(start))
+		: static_cast<U>(static_cast<U>(start) - static_cast<U>(std::numeric_limits<T>::min()));
+	const unsigned long long fit = step == 0 ? std::numeric_limits<unsigned long long>::max() : room / step;
+
+	out_of_range = steps > fit;
+	const U taken = static_cast<U>(out_of_range ? fit : steps);
+	// taken * step <= room, so neither the product nor the move can wrap
+	const U moved = static_cast<U>(step * taken);
+	return static_cast<T>(up ? static_cast<U>(static_cast<U>(start) + moved) : static_cast<U>(static_cast<U>(start) - moved));
+}
+
+/// <summary>
+/// move_within_range, with Policy deciding the value when not all of the steps fit
+/// </summary>
+template <typename T, overflow_policy Policy>
+constexpr checked_result<T> move_integer(T const& start, std::make_unsigned_t<T> const& step, bool up, unsigned long int const& steps)
+{
+	using U = std::make_unsigned_t<T>;
+
+	bool out_of_range = false;
+	T value = move_within_range<T>(start, step, up, steps, out_of_range);
+
+	if constexpr (Policy == overflow_policy::saturate) {
+		if (out_of_range) value = up ? std::numeric_limits<T>::max() : std::numeric_limits<T>::min();
+	}
+	else if constexpr (Policy == overflow_policy::wrap) {
+		// unsigned arithmetic is already modulo 2^N, so the whole move is one multiply
+		const U moved = static_cast<U>(static_cast<unsigned long long>(step) * steps);
+		value = static_cast<T>(up ? static_cast<U>(static_cast<U>(start) + moved) : static_cast<U>(static_cast<U>(start) - moved));
+	}
+	return { value, out_of_range };
+}
+
+/// <summary>
+/// start + increment * k for the largest k up to steps, rounded once, where k is worked out from how
+/// many increments fit in the room left rather than by adding them up
+/// </summary>
+/// <typeparam name="T">A floating point type</typeparam>
+/// <param name="half_room">Half of how far start can move before the check fails. Halved so that
+/// the distance from near lowest() to max() does not overflow</param>
+/// <param name="out_of_range">Set to true if not all of the steps fit</param>
+template <typename T>
+constexpr T move_floating(T const& start, T const& increment, long double half_room, unsigned long int const& steps, bool& out_of_range)
+{
+	const long double size = increment < 0 ? -static_cast<long double>(increment) : static_cast<long double>(increment);
+	const long double fit = half_room / size * 2;
+	// steps is whole, so it is past floor(fit) exactly when it is past fit, and then fit is small
+	// enough for the conversion to take its floor
+	out_of_range = static_cast<long double>(steps) > fit;
+	const long double taken = out_of_range ? static_cast<long double>(static_cast<unsigned long long>(fit)) : static_cast<long double>(steps);
+	return static_cast<T>(static_cast<long double>(start) + static_cast<long double>(increment) * taken);
+}
+
+/// <summary>
+/// Applies Policy to a floating point result that did not fit
+/// </summary>
+/// <param name="end">The end of the range the check guards</param>
+/// <param name="delta">What was added each step</param>
+template <typename T, overflow_policy Policy>
+constexpr checked_result<T> apply_floating_policy(checked_result<T> result, T const& end, T const& start, T const& delta, unsigned long int const& steps)
+{
+	if (!result.out_of_range) return result;
+
+	if constexpr (Policy == overflow_policy::saturate) {
+		result.value = end;
+	}
+	else if constexpr (Policy == overflow_policy::wrap) {
+		// rounded the same way as a run that fits would have been
+		if (steps > floating_stepwise_limit) {
+			result.value = static_cast<T>(static_cast<long double>(start) + static_cast<long double>(delta) * steps);
+		}
+		else {
+			result.value = start;
+			for (unsigned long int i = 0; i < steps; ++i) result.value += delta;
+		}
+	}
+	return result;
+}
+
+/// <summary>
+/// The floating point half of checked_add, stopping before the step that would pass max
+/// </summary>
+template <typename T>
+constexpr checked_result<T> add_floating(T const& start, T const& increment, unsigned long int const& steps)
 {
 	T result = start;
-	overflow_flag = false;
 	T range_check_value = 0;
 
+	if (steps > floating_stepwise_limit)
+	{
+		// the loop never fails a step that moves away from max, and fails at once on NaN
+		const long double half_room = static_cast<long double>(std::numeric_limits<T>::max()) / 2 - static_cast<long double>(start) / 2;
+		if (!(static_cast<long double>(increment) / 2 <= half_room)) return { start, true };
+		if (increment <= 0) return { static_cast<T>(static_cast<long double>(start) + static_cast<long double>(increment) * steps), false };
+		bool overflow = false;
+		result = move_floating<T>(start, increment, half_room, steps, overflow);
+		return { result, overflow };
+	}
+
 	for (unsigned long int i = 0; i < steps; ++i)
 	{
 		range_check_value = std::numeric_limits<T>::max() - result;
@@ -33,14 +191,130 @@ T add_numbers(T const& start, T const& increment, unsigned long int const& steps
 			result += increment;
 		}
 		else {
-			overflow_flag = true;
-			break;
+			return { result, true };
 		}
 	}
 
-	return result;
+	return { result, false };
+}
+
+/// <summary>
+/// The floating point half of checked_subtract, stopping before the step that would cross zero
+/// </summary>
+template <typename T>
+constexpr checked_result<T> subtract_floating(T const& start, T const& decrement, unsigned long int const& steps)
+{
+	T result = start;
+	T range_check_value = 0;
+
+	if (steps > floating_stepwise_limit)
+	{
+		// the loop's check is decrement <= |result|: from a start at or above zero it stops before
+		// crossing zero, otherwise (and for a decrement that is not positive) no step fails, NaN fails
+		// at once
+		const T distance = start < 0 ? -start : start;
+		if (!(decrement <= distance)) return { start, true };
+		if (decrement <= 0 || start < 0) return { static_cast<T>(static_cast<long double>(start) - static_cast<long double>(decrement) * steps), false };
+		bool underflow = false;
+		result = move_floating<T>(start, static_cast<T>(-decrement), static_cast<long double>(start) / 2, steps, underflow);
+		return { result, underflow };
+	}
+
+	for (unsigned long int i = 0; i < steps; ++i)
+	{
+		// the gap between the current result and the end of the range. numeric_limits<T>::min() is
+		// positive for floating types, so that gap is |result|
+		range_check_value = result < 0 ? -result : result;
+
+		// JR: precondition range check to prevent overflow
+		if (decrement <= range_check_value) {
+			result -= decrement;
+		}
+		else {
+			return { result, true };
+		}
+	}
+
+	return { result, false };
+}
+
+/// <summary>
+/// start + (increment * steps), checked against the end of T's range. Touches no shared state, and
+/// picks its arithmetic for signed, unsigned and floating point T at compile time, so it can also be
+/// used in constant expressions
+/// </summary>
+/// <typeparam name="T">A type that with basic math functions</typeparam>
+/// <typeparam name="Policy">What to give back when not all of the steps fit</typeparam>
+/// <param name="start">The number to start with</param>
+/// <param name="increment">How much to add each step</param>
+/// <param name="steps">The number of steps to iterate</param>
+/// <returns>The sum, and whether it overflowed</returns>
+template <typename T, overflow_policy Policy = overflow_policy::detect>
+constexpr checked_result<T> checked_add(T const& start, T const& increment, unsigned long int const& steps)
+{
+	// the original loop stops at the first step that would pass max, so integers can work out how many
+	// steps fit directly. a negative step is checked against min the same way
+	if constexpr (std::is_integral_v<T>)
+	{
+		const bool down = std::is_signed_v<T> && increment < 0;
+		return move_integer<T, Policy>(start, magnitude(increment), !down, steps);
+	}
+	else
+	{
+		return apply_floating_policy<T, Policy>(add_floating(start, increment, steps), std::numeric_limits<T>::max(), start, increment, steps);
+	}
+}
+
+/// <summary>
+/// Template function to abstract away the logic of:
+///   start + (increment * steps)
+/// </summary>
+/// <typeparam name="T">A type that with basic math functions</typeparam>
+/// <param name="start">The number to start with</param>
+/// <param name="increment">How much to add each step</param>
+/// <param name="steps">The number of steps to iterate</param>
+/// <returns>start + (increment * steps)</returns>
+template <typename T>
+T add_numbers(T const& start, T const& increment, unsigned long int const& steps)
+{
+	// the work is done by checked_add, this only reports through the global flag
+	const checked_result<T> checked = checked_add<T>(start, increment, steps);
+	overflow_flag = checked.out_of_range;
+	return checked.value;
 }
 
+/// <summary>
+/// start - (decrement * steps), checked against the end of T's range, which is zero for floating point
+/// as numeric_limits<T>::min() is positive there. Like checked_add, shares no state and is constexpr
+/// </summary>
+/// <typeparam name="T">A type that with basic math functions</typeparam>
+/// <typeparam name="Policy">What to give back when not all of the steps fit</typeparam>
+/// <param name="start">The number to start with</param>
+/// <param name="decrement">How much to subtract each step</param>
+/// <param name="steps">The number of steps to iterate</param>
+/// <returns>The difference, and whether it underflowed</returns>
+template <typename T, overflow_policy Policy = overflow_policy::detect>
+constexpr checked_result<T> checked_subtract(T const& start, T const& decrement, unsigned long int const& steps)
+{
+	// as in checked_add, integers work out how many steps fit before min directly, and a negative step
+	// is checked against max
+	if constexpr (std::is_integral_v<T>)
+	{
+		const bool up = std::is_signed_v<T> && decrement < 0;
+		return move_integer<T, Policy>(start, magnitude(decrement), up, steps);
+	}
+	else
+	{
+		return apply_floating_policy<T, Policy>(subtract_floating(start, decrement, steps), T(0), start, static_cast<T>(-decrement), steps);
+	}
+}
+
+// checked_add and checked_subtract are constant expressions for every kind of T and every policy
+static_assert(checked_add<int>(0, std::numeric_limits<int>::max() / 5, 6).out_of_range);
+static_assert(checked_add<unsigned char, overflow_policy::saturate>(250, 3, 2).value == 255);
+static_assert(checked_subtract<short, overflow_policy::wrap>(-32768, 1, 1).value == 32767);
+static_assert(checked_subtract<double>(1.0, 0.25, 100).value == 0.0);
+
 /// <summary>
 /// Template function to abstract away the logic of:
 ///   start - (increment * steps)
@@ -54,41 +328,220 @@ T add_numbers(T const& start, T const& increment, unsigned long int const& steps
 template <typename T>
 T subtract_numbers(T const& start, T const& decrement, unsigned long int const& steps)
 {
-	T result = start;
-	underflow_flag = false;
-	T range_check_value = 0;
+	// the work is done by checked_subtract, this only reports through the global flag
+	const checked_result<T> checked = checked_subtract<T>(start, decrement, steps);
+	underflow_flag = checked.out_of_range;
+	return checked.value;
+}
 
-	for (unsigned long int i = 0; i < steps; ++i)
-	{
-		// JR: detects the gap between current result and the end of range for the given type
-		if (+std::numeric_limits<T>::min() < 0) {
-			range_check_value = +std::numeric_limits<T>::min() - result;
+
+// the batch functions work through their input this many elements at a time, one word of the
+// overflow mask per block
+const std::size_t batch_block = 64;
+
+/// <summary>
+/// true if bit index of a mask returned by checked_add_batch or checked_subtract_batch is set
+/// </summary>
+inline bool is_out_of_range(std::vector<std::uint64_t> const& mask, std::size_t index)
+{
+	return (mask[index / batch_block] >> (index % batch_block)) & 1;
+}
+
+/// <summary>
+/// move_integer over a block of starts. Every start is first moved the whole way, with no branches or
+/// divisions so the loop vectorizes, which is already the wrapped value. Only the starts that did not
+/// have room are then redone one at a time, unless Policy is wrap
+/// </summary>
+/// <returns>The block's word of the overflow mask</returns>
+template <typename T, overflow_policy Policy>
+std::uint64_t move_integer_block(T const* starts, std::size_t count, std::make_unsigned_t<T> const& step, bool up, unsigned long int const& steps, T* results)
+{
+	using U = std::make_unsigned_t<T>;
+
+	// a move too big for U cannot fit from any start
+	if (step != 0 && steps > std::numeric_limits<U>::max() / step) {
+		std::uint64_t mask = 0;
+		for (std::size_t j = 0; j < count; ++j) {
+			const checked_result<T> checked = move_integer<T, Policy>(starts[j], step, up, steps);
+			results[j] = checked.value;
+			mask |= std::uint64_t(checked.out_of_range) << j;
 		}
-		else {
-			range_check_value = result;
+		return mask;
+	}
+
+	const U total = static_cast<U>(step * static_cast<U>(steps));
+	const U edge = static_cast<U>(up ? std::numeric_limits<T>::max() : std::numeric_limits<T>::min());
+	unsigned char out[batch_block];
+	for (std::size_t j = 0; j < count; ++j) {
+		const U start = static_cast<U>(starts[j]);
+		const U room = static_cast<U>(up ? edge - start : start - edge);
+		out[j] = room < total;
+		results[j] = static_cast<T>(static_cast<U>(up ? start + total : start - total));
+	}
+
+	std::uint64_t mask = 0;
+	for (std::size_t j = 0; j < count; ++j) mask |= std::uint64_t(out[j]) << j;
+	if constexpr (Policy != overflow_policy::wrap) {
+		for (std::uint64_t redo = mask; redo != 0; redo &= redo - 1) {
+			const std::size_t j = std::countr_zero(redo);
+			// starts may be results, so take the start back out of the wrapped result
+			const U result = static_cast<U>(results[j]);
+			const T start = static_cast<T>(static_cast<U>(up ? result - total : result + total));
+			results[j] = move_integer<T, Policy>(start, step, up, steps).value;
 		}
+	}
+	return mask;
+}
 
-		// JR: Tried to use abs() to resolve this, but abs() doesn't seem to be
-		// overloaded for all types tested?
-		if (range_check_value < 0) range_check_value *= -1;
+/// <summary>
+/// The stepwise floating point loop of checked_add and checked_subtract over a block of starts. The
+/// steps are the outer loop and the block the inner one, so each step is one vectorized pass, and an
+/// element that fails a step stops there exactly as the single loop would
+/// </summary>
+/// <param name="delta">What is added each step</param>
+/// <param name="end">The end of the range the check guards, for the saturate policy</param>
+/// <param name="fits">Whether the next step from a value stays in range</param>
+/// <param name="safe">Whether every step from a start is sure to fit. When all of the block is, the
+/// steps are added without checking them</param>
+/// <returns>The block's word of the overflow mask</returns>
+template <typename T, overflow_policy Policy, typename Fits, typename Safe>
+std::uint64_t step_floating_block(T const* starts, std::size_t count, T const& delta, T const& end, unsigned long int const& steps, Fits fits, Safe safe, T* results)
+{
+	const T step = delta;
+	T value[batch_block];
+	T addend[batch_block];
+	unsigned char out[batch_block];
+	bool all_safe = true;
+	for (std::size_t j = 0; j < count; ++j) {
+		value[j] = starts[j];
+		out[j] = 0;
+		all_safe &= safe(starts[j]);
+	}
 
-		// JR: for debugging 
-		//std::cout << std::endl << "range_check_value: " << +range_check_value;
-		//std::cout << std::endl << "decrement: " << +decrement << std::endl;
-		
-		// JR: precondition range check to prevent overflow
-		if (decrement <= range_check_value) {
-			result -= decrement;
+	if (all_safe) {
+		for (unsigned long int i = 0; i < steps; ++i) {
+			for (std::size_t j = 0; j < count; ++j) value[j] += step;
 		}
-		else {
-			underflow_flag = true;
-			break;
+		for (std::size_t j = 0; j < count; ++j) results[j] = value[j];
+		return 0;
+	}
+
+	for (unsigned long int i = 0; i < steps; ++i) {
+		// adding -0.0 leaves every value as it is, -0.0 and NaN included, so stopped elements need no
+		// branch. the add is its own loop, as a fused one is turned back into a conditional add, which
+		// the compiler will not vectorize because the add could trap. wrap keeps adding regardless
+		for (std::size_t j = 0; j < count; ++j) {
+			out[j] |= !fits(value[j]);
+			addend[j] = out[j] && Policy != overflow_policy::wrap ? T(-0.0) : step;
 		}
+		for (std::size_t j = 0; j < count; ++j) value[j] += addend[j];
 	}
 
-	return result;
+	std::uint64_t mask = 0;
+	for (std::size_t j = 0; j < count; ++j) {
+		results[j] = Policy == overflow_policy::saturate && out[j] ? end : value[j];
+		mask |= std::uint64_t(out[j]) << j;
+	}
+	return mask;
+}
+
+/// <summary>
+/// checked_add of the same increment and steps to every element of starts
+/// </summary>
+/// <typeparam name="T">A type that with basic math functions</typeparam>
+/// <typeparam name="Policy">What to give back for the elements where not all of the steps fit</typeparam>
+/// <param name="starts">The numbers to start with</param>
+/// <param name="increment">How much to add each step</param>
+/// <param name="steps">The number of steps to iterate</param>
+/// <param name="results">Receives each sum, at least as long as starts. May be starts itself</param>
+/// <returns>One bit per element, set where it overflowed. See is_out_of_range</returns>
+template <typename T, overflow_policy Policy = overflow_policy::detect>
+std::vector<std::uint64_t> checked_add_batch(std::span<const T> starts, T const& increment, unsigned long int const& steps, std::span<T> results)
+{
+	std::vector<std::uint64_t> mask((starts.size() + batch_block - 1) / batch_block);
+
+	for (std::size_t block = 0; block < mask.size(); ++block) {
+		const std::size_t first = block * batch_block;
+		const std::size_t count = std::min(batch_block, starts.size() - first);
+		T* const out = results.data() + first;
+
+		if constexpr (std::is_integral_v<T>)
+		{
+			const bool down = std::is_signed_v<T> && increment < 0;
+			mask[block] = move_integer_block<T, Policy>(starts.data() + first, count, magnitude(increment), !down, steps, out);
+		}
+		else if (steps > floating_stepwise_limit)
+		{
+			// already constant time per element
+			for (std::size_t j = 0; j < count; ++j) {
+				const checked_result<T> checked = checked_add<T, Policy>(starts[first + j], increment, steps);
+				out[j] = checked.value;
+				mask[block] |= std::uint64_t(checked.out_of_range) << j;
+			}
+		}
+		else
+		{
+			// the sum cannot reach past three quarters of max from a start at or below half of it, even
+			// rounding up at every step, and a step that is not positive only fails from NaN or +inf
+			const T max = std::numeric_limits<T>::max();
+			const bool small = std::isfinite(increment) && (increment <= 0 || increment * static_cast<T>(steps + 1) <= max / 4);
+			mask[block] = step_floating_block<T, Policy>(starts.data() + first, count, increment, max, steps,
+				[increment, max](T const& value) { return increment <= max - value; },
+				[increment, max, small](T const& value) { return small && (increment <= 0 ? value <= max : value <= max / 2); }, out);
+		}
+	}
+
+	return mask;
 }
 
+/// <summary>
+/// checked_subtract of the same decrement and steps from every element of starts
+/// </summary>
+/// <typeparam name="T">A type that with basic math functions</typeparam>
+/// <typeparam name="Policy">What to give back for the elements where not all of the steps fit</typeparam>
+/// <param name="starts">The numbers to start with</param>
+/// <param name="decrement">How much to subtract each step</param>
+/// <param name="steps">The number of steps to iterate</param>
+/// <param name="results">Receives each difference, at least as long as starts. May be starts itself</param>
+/// <returns>One bit per element, set where it underflowed. See is_out_of_range</returns>
+template <typename T, overflow_policy Policy = overflow_policy::detect>
+std::vector<std::uint64_t> checked_subtract_batch(std::span<const T> starts, T const& decrement, unsigned long int const& steps, std::span<T> results)
+{
+	std::vector<std::uint64_t> mask((starts.size() + batch_block - 1) / batch_block);
+
+	for (std::size_t block = 0; block < mask.size(); ++block) {
+		const std::size_t first = block * batch_block;
+		const std::size_t count = std::min(batch_block, starts.size() - first);
+		T* const out = results.data() + first;
+
+		if constexpr (std::is_integral_v<T>)
+		{
+			const bool up = std::is_signed_v<T> && decrement < 0;
+			mask[block] = move_integer_block<T, Policy>(starts.data() + first, count, magnitude(decrement), up, steps, out);
+		}
+		else if (steps > floating_stepwise_limit)
+		{
+			for (std::size_t j = 0; j < count; ++j) {
+				const checked_result<T> checked = checked_subtract<T, Policy>(starts[first + j], decrement, steps);
+				out[j] = checked.value;
+				mask[block] |= std::uint64_t(checked.out_of_range) << j;
+			}
+		}
+		else
+		{
+			// x + -decrement is exactly x - decrement
+			// a start at or below -decrement only moves away from zero, and one at least twice the whole
+			// run from it cannot get within decrement of zero, even rounding down at every step
+			const T run = static_cast<T>(2) * decrement * static_cast<T>(steps + 1);
+			const bool finite = std::isfinite(decrement);
+			mask[block] = step_floating_block<T, Policy>(starts.data() + first, count, static_cast<T>(-decrement), T(0), steps,
+				[decrement](T const& value) { return decrement <= std::fabs(value); },
+				[decrement, run, finite](T const& value) { return finite && (decrement <= 0 ? value == value : value <= -decrement || value >= run); }, out);
+		}
+	}
+
+	return mask;
+}
 
 //  NOTE:
 //    You will see the unary ('+') operator used in front of the variables in the test_XXX methods.
@@ -259,6 +712,77 @@ void do_underflow_tests(const std::string& star_line)
 	test_underflow<long double>();
 }
 
+/// <summary>
+/// Runs checked_add_batch and checked_subtract_batch over the awkward starts (the ends of T's range,
+/// zero, and for floating point infinities and NaN), each alone and all in one block, and compares
+/// every element with checked_add and checked_subtract
+/// </summary>
+/// <returns>The number of elements that differ</returns>
+template <typename T, overflow_policy Policy>
+std::size_t count_batch_mismatches()
+{
+	std::vector<T> values = { T(0), T(1), T(100), std::numeric_limits<T>::max(), static_cast<T>(std::numeric_limits<T>::max() - 1),
+		std::numeric_limits<T>::lowest(), static_cast<T>(std::numeric_limits<T>::max() / 5) };
+	if constexpr (std::is_signed_v<T>) {
+		values.insert(values.end(), { T(-1), static_cast<T>(std::numeric_limits<T>::lowest() / 5) });
+	}
+	if constexpr (!std::is_integral_v<T>) {
+		values.insert(values.end(), { T(-0.0), std::numeric_limits<T>::min(), std::numeric_limits<T>::infinity(),
+			-std::numeric_limits<T>::infinity(), std::numeric_limits<T>::quiet_NaN() });
+	}
+	const unsigned long int step_counts[] = { 0, 1, 5, floating_stepwise_limit, floating_stepwise_limit + 1, 1000 };
+	const auto same = [](T const& a, T const& b) { return a == b || (a != a && b != b); };
+
+	std::size_t mismatches = 0;
+	for (const T& delta : values) {
+		for (const unsigned long int steps : step_counts) {
+			for (std::size_t first = 0; first <= values.size(); ++first) {
+				// one start at a time, then all of them together
+				const std::span<const T> starts = first < values.size() ? std::span<const T>(&values[first], 1) : std::span<const T>(values);
+				std::vector<T> sums(starts.size()), differences(starts.size());
+				const std::vector<std::uint64_t> overflows = checked_add_batch<T, Policy>(starts, delta, steps, sums);
+				const std::vector<std::uint64_t> underflows = checked_subtract_batch<T, Policy>(starts, delta, steps, differences);
+
+				for (std::size_t i = 0; i < starts.size(); ++i) {
+					const checked_result<T> sum = checked_add<T, Policy>(starts[i], delta, steps);
+					const checked_result<T> difference = checked_subtract<T, Policy>(starts[i], delta, steps);
+					mismatches += sum.out_of_range != is_out_of_range(overflows, i);
+					mismatches += !same(sum.value, sums[i]);
+					mismatches += difference.out_of_range != is_out_of_range(underflows, i);
+					mismatches += !same(difference.value, differences[i]);
+				}
+			}
+		}
+	}
+	return mismatches;
+}
+
+template <typename T>
+std::size_t count_batch_mismatches()
+{
+	return count_batch_mismatches<T, overflow_policy::detect>() + count_batch_mismatches<T, overflow_policy::saturate>()
+		+ count_batch_mismatches<T, overflow_policy::wrap>();
+}
+
+/// <summary>
+/// Checks the batch functions against the single ones for every type the tests use, printing only
+/// when they disagree so the test output is unchanged
+/// </summary>
+void do_batch_checks()
+{
+	const std::size_t mismatches = count_batch_mismatches<char>() + count_batch_mismatches<wchar_t>()
+		+ count_batch_mismatches<short int>() + count_batch_mismatches<int>() + count_batch_mismatches<long>()
+		+ count_batch_mismatches<long long>() + count_batch_mismatches<unsigned char>()
+		+ count_batch_mismatches<unsigned short int>() + count_batch_mismatches<unsigned int>()
+		+ count_batch_mismatches<unsigned long>() + count_batch_mismatches<unsigned long long>()
+		+ count_batch_mismatches<float>() + count_batch_mismatches<double>() + count_batch_mismatches<long double>();
+
+	if (mismatches != 0) {
+		std::cout << std::endl << "*** Batch checked arithmetic differs from checked_add / checked_subtract in "
+			<< mismatches << " results ***" << std::endl;
+	}
+}
+
 /// <summary>
 /// Entry point into the application
 /// </summary>
@@ -276,6 +800,9 @@ int main()
 	// run the underflow tests
 	do_underflow_tests(star_line);
 
+	// check the batch functions against the single ones
+	do_batch_checks();
+
 	std::cout << std::endl << "All Numeric Underflow / Overflow Tests Complete!" << std::endl;
 
 	return 0;
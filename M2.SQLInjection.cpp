@@ -2,10 +2,40 @@
 //
 
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <charconv>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <future>
+#include <iomanip>
 #include <iostream>
+#include <list>
 #include <locale>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string_view>
+#include <thread>
 #include <tuple>
+#include <unordered_map>
 #include <vector>
+#include <cerrno>
+#include <cstring>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#include <sys/stat.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 #include "sqlite3.h"
 
@@ -73,32 +103,52 @@ bool initialize_database(sqlite3* db)
   return true;
 }
 
-bool run_query(sqlite3* db, const std::string& sql, std::vector< user_record >& records)
+/// <summary>
+/// settings for bulk_load_users. the pragmas trade durability for speed while loading, the
+/// defaults suit an in-memory or rebuildable database
+/// </summary>
+struct bulk_load_options
 {
-  // TODO: Fix this method to fail and display an error if there is a suspected SQL Injection
-  //  NOTE: You cannot just flag 1=1 as an error, since 2=2 will work just as well. You need
-  //  something more generic
+  // DELETE, TRUNCATE, PERSIST, MEMORY, WAL or OFF
+  std::string journal_mode = "MEMORY";
+  // OFF, NORMAL, FULL or EXTRA
+  std::string synchronous = "OFF";
+  // pages if positive, KiB if negative (sqlite's convention), 0 leaves it alone
+  int cache_size = -64 * 1024;
+};
 
-  // clear any prior results
-  records.clear();
+/// <summary>
+/// apply the bulk load pragmas. values are checked against sqlite's keywords first, pragmas
+/// cannot take bound parameters so nothing unchecked goes into the sql text
+/// </summary>
+/// <returns>true if every pragma was applied</returns>
+bool apply_bulk_load_pragmas(sqlite3* db, const bulk_load_options& options)
+{
+  static const char* const journal_modes[] = { "DELETE", "TRUNCATE", "PERSIST", "MEMORY", "WAL", "OFF" };
+  static const char* const synchronous_modes[] = { "OFF", "NORMAL", "FULL", "EXTRA" };
 
-  // JR: Copies and transforms sql command to all lowercase to make subsequent find() 
-  //  functionally case-insensitive
-  std::string localCopy(sql);
-  std::transform(localCopy.begin(), localCopy.end(), localCopy.begin(), ::tolower);
+  auto is_one_of = [](const std::string& value, const char* const* allowed, size_t count)
+  {
+    return std::any_of(allowed, allowed + count, [&](const char* keyword) { return sqlite3_stricmp(value.c_str(), keyword) == 0; });
+  };
 
-  // JR: If transformed sql command contains ' or ', returns before running query
-  std::size_t pos = localCopy.find(" or ");
-  if (pos != std::string::npos) {
-      // JR: string contains ' or '
-      std::cout << std::endl << "***POSSIBLE SQL INJECTION DETECTED***" << std::endl;
-      return false;
+  if (!is_one_of(options.journal_mode, journal_modes, sizeof journal_modes / sizeof journal_modes[0]) ||
+    !is_one_of(options.synchronous, synchronous_modes, sizeof synchronous_modes / sizeof synchronous_modes[0]))
+  {
+    std::cout << "Invalid bulk load pragma. journal_mode = " << options.journal_mode << " synchronous = " << options.synchronous << std::endl;
+    return false;
   }
 
-  char* error_message;
-  if(sqlite3_exec(db, sql.c_str(), callback, &records, &error_message) != SQLITE_OK)
+  std::string sql = "PRAGMA journal_mode=" + options.journal_mode + ";PRAGMA synchronous=" + options.synchronous + ";";
+  if (options.cache_size != 0)
   {
-    std::cout << "Data failed to be queried from USERS table. ERROR = " << error_message << std::endl;
+    sql += "PRAGMA cache_size=" + std::to_string(options.cache_size) + ";";
+  }
+
+  char* error_message = NULL;
+  if (sqlite3_exec(db, sql.c_str(), NULL, NULL, &error_message) != SQLITE_OK)
+  {
+    std::cout << "Failed to apply bulk load pragmas. ERROR = " << error_message << std::endl;
     sqlite3_free(error_message);
     return false;
   }
@@ -106,116 +156,3455 @@ bool run_query(sqlite3* db, const std::string& sql, std::vector< user_record >&
   return true;
 }
 
-// DO NOT CHANGE
-bool run_query_injection(sqlite3* db, const std::string& sql, std::vector< user_record >& records)
+/// <summary>
+/// read the connection's current values of the pragmas bulk_load_options sets, so a load can put
+/// them back afterwards
+/// </summary>
+/// <returns>true if every pragma was read</returns>
+bool read_bulk_load_pragmas(sqlite3* db, bulk_load_options& current)
 {
-  std::string injectedSQL(sql);
-  std::string localCopy(sql);
+  static const char* const synchronous_modes[] = { "OFF", "NORMAL", "FULL", "EXTRA" };
 
-  // we work on the local copy because of the const
-  std::transform(localCopy.begin(), localCopy.end(), localCopy.begin(), ::tolower);
-  if(localCopy.find_last_of(str_where) >= 0)
-  { // this sql has a where clause
-    if(localCopy.back() == ';')
-    { // smart SQL developer terminated with a semicolon - we can fix that!
-      injectedSQL.pop_back();
+  auto read_pragma = [db](const char* sql, std::string& value)
+  {
+    sqlite3_stmt* statement = NULL;
+    bool found = false;
+    if (sqlite3_prepare_v2(db, sql, -1, &statement, NULL) == SQLITE_OK && sqlite3_step(statement) == SQLITE_ROW)
+    {
+      const unsigned char* text = sqlite3_column_text(statement, 0);
+      value = text ? reinterpret_cast<const char*>(text) : "";
+      found = true;
     }
+    sqlite3_finalize(statement);
+    return found;
+  };
 
-    switch (rand() % 4)
+  std::string synchronous;
+  std::string cache_size;
+  if (!read_pragma("PRAGMA journal_mode;", current.journal_mode) || !read_pragma("PRAGMA synchronous;", synchronous) ||
+    !read_pragma("PRAGMA cache_size;", cache_size))
+  {
+    std::cout << "Failed to read the current pragmas. ERROR = " << sqlite3_errmsg(db) << std::endl;
+    return false;
+  }
+
+  // synchronous reads back as its number
+  const size_t level = synchronous.length() == 1 ? static_cast<size_t>(synchronous[0] - '0') : 0;
+  current.synchronous = synchronous_modes[level < sizeof synchronous_modes / sizeof synchronous_modes[0] ? level : 0];
+  current.cache_size = 0;
+  std::from_chars(cache_size.data(), cache_size.data() + cache_size.length(), current.cache_size);
+  return true;
+}
+
+// rows per INSERT in a bulk load. one statement step per row costs as much as the insert itself, a
+// multi-row VALUES list shares it. 3 parameters a row keeps this under the 999 of older sqlite builds
+const size_t bulk_insert_rows = 256;
+
+/// <summary>
+/// inserts USERS rows inside one transaction, bulk_insert_rows at a time through one prepared
+/// multi-row INSERT. the transaction is rolled back if any row fails, so a load is all or nothing.
+/// the bulk load pragmas only last for the load, the connection's own settings are put back when it
+/// commits or rolls back
+/// </summary>
+class users_bulk_loader
+{
+public:
+  explicit users_bulk_loader(sqlite3* db)
+    : db_(db)
+  {
+  }
+
+  users_bulk_loader(const users_bulk_loader&) = delete;
+  users_bulk_loader& operator=(const users_bulk_loader&) = delete;
+
+  ~users_bulk_loader()
+  {
+    if (in_transaction_)
     {
-    case 1:
-      injectedSQL.append(" or 2=2;");
-      break;
-    case 2:
-      injectedSQL.append(" or 'hi'='hi';");
-      break;
-    case 3:
-      injectedSQL.append(" or 'hack'='hack';");
-      break;
-    case 0:
-    default:
-      injectedSQL.append(" or 1=1;");
-      break;
+      sqlite3_exec(db_, "ROLLBACK;", NULL, NULL, NULL);
     }
+    restore_pragmas();
+    sqlite3_finalize(insert_);
+    sqlite3_finalize(insert_batch_);
   }
-  
-  return run_query(db, injectedSQL, records);
+
+  bool begin(const bulk_load_options& options)
+  {
+    if (!read_bulk_load_pragmas(db_, previous_)) return false;
+    restore_ = true;
+    if (!apply_bulk_load_pragmas(db_, options)) return false;
+
+    std::string batch_sql = "INSERT INTO USERS (ID, NAME, PASSWORD) VALUES (?, ?, ?)";
+    for (size_t i = 1; i < bulk_insert_rows; ++i)
+    {
+      batch_sql += ",(?, ?, ?)";
+    }
+    pending_.reserve(bulk_insert_rows);
+
+    if (sqlite3_prepare_v3(db_, "INSERT INTO USERS (ID, NAME, PASSWORD) VALUES (?, ?, ?)", -1, SQLITE_PREPARE_PERSISTENT, &insert_, NULL) != SQLITE_OK ||
+      sqlite3_prepare_v3(db_, batch_sql.c_str(), -1, SQLITE_PREPARE_PERSISTENT, &insert_batch_, NULL) != SQLITE_OK ||
+      sqlite3_exec(db_, "BEGIN;", NULL, NULL, NULL) != SQLITE_OK)
+    {
+      std::cout << "Data failed to insert to USERS table. ERROR = " << sqlite3_errmsg(db_) << std::endl;
+      return false;
+    }
+    in_transaction_ = true;
+    return true;
+  }
+
+  /// <summary>
+  /// queue one row, inserted with the rest of its batch. the text only has to stay alive for the
+  /// duration of the call, it is copied until the batch goes in
+  /// </summary>
+  bool add(sqlite3_int64 id, std::string_view name, std::string_view password)
+  {
+    pending_.push_back({ id, pending_text_.length(), name.length(), password.length() });
+    pending_text_.append(name).append(password);
+    return pending_.size() < bulk_insert_rows || flush();
+  }
+
+  bool commit()
+  {
+    if (!flush()) return false; // the destructor rolls back
+    in_transaction_ = false;
+    if (sqlite3_exec(db_, "COMMIT;", NULL, NULL, NULL) != SQLITE_OK)
+    {
+      std::cout << "Data failed to insert to USERS table. ERROR = " << sqlite3_errmsg(db_) << std::endl;
+      sqlite3_exec(db_, "ROLLBACK;", NULL, NULL, NULL);
+      restore_pragmas();
+      return false;
+    }
+    return restore_pragmas();
+  }
+
+  size_t rows() const { return rows_; }
+
+private:
+  // a queued row, its name and password sit one after the other in pending_text_
+  struct pending_row
+  {
+    sqlite3_int64 id;
+    size_t text_offset;
+    size_t name_length;
+    size_t password_length;
+  };
+
+  // bind a queued row to the parameters from first on, the text stays put until the batch is cleared
+  void bind_row(sqlite3_stmt* statement, int first, const pending_row& row)
+  {
+    const char* text = pending_text_.data() + row.text_offset;
+    sqlite3_bind_int64(statement, first, row.id);
+    sqlite3_bind_text(statement, first + 1, text, static_cast<int>(row.name_length), SQLITE_STATIC);
+    sqlite3_bind_text(statement, first + 2, text + row.name_length, static_cast<int>(row.password_length), SQLITE_STATIC);
+  }
+
+  /// <summary>
+  /// insert the queued rows, as one statement for a full batch. a failed statement changes nothing,
+  /// so a failed batch is gone through a row at a time to report the row at fault
+  /// </summary>
+  bool flush()
+  {
+    bool inserted = false;
+    if (pending_.size() == bulk_insert_rows)
+    {
+      for (size_t i = 0; i < pending_.size(); ++i)
+      {
+        bind_row(insert_batch_, static_cast<int>(3 * i + 1), pending_[i]);
+      }
+      inserted = sqlite3_step(insert_batch_) == SQLITE_DONE;
+      sqlite3_reset(insert_batch_);
+    }
+
+    if (!inserted)
+    {
+      for (const auto& row : pending_)
+      {
+        bind_row(insert_, 1, row);
+        const int result = sqlite3_step(insert_);
+        sqlite3_reset(insert_);
+        if (result != SQLITE_DONE)
+        {
+          std::cout << "Data failed to insert to USERS table. ID = " << row.id << " ERROR = " << sqlite3_errmsg(db_) << std::endl;
+          return false;
+        }
+      }
+    }
+
+    rows_ += pending_.size();
+    pending_.clear();
+    pending_text_.clear();
+    return true;
+  }
+
+  /// <summary>
+  /// put back the pragmas begin replaced, once the transaction is over (journal_mode cannot change
+  /// inside one)
+  /// </summary>
+  bool restore_pragmas()
+  {
+    if (!restore_) return true;
+    restore_ = false;
+    return apply_bulk_load_pragmas(db_, previous_);
+  }
+
+  sqlite3* db_;
+  sqlite3_stmt* insert_ = NULL;
+  sqlite3_stmt* insert_batch_ = NULL;
+  std::vector<pending_row> pending_;
+  std::string pending_text_;
+  bool in_transaction_ = false;
+  bulk_load_options previous_;
+  bool restore_ = false;
+  size_t rows_ = 0;
+};
+
+/// <summary>
+/// bulk load USERS rows from memory
+/// </summary>
+/// <param name="db">connection with a USERS table</param>
+/// <param name="users">rows to insert, ID must be numeric</param>
+/// <param name="options">pragmas to load with</param>
+/// <returns>true if every row was inserted</returns>
+bool bulk_load_users(sqlite3* db, const std::vector< user_record >& users, const bulk_load_options& options = bulk_load_options())
+{
+  users_bulk_loader loader(db);
+  if (!loader.begin(options)) return false;
+
+  for (const auto& user : users)
+  {
+    const std::string& id = std::get<0>(user);
+    sqlite3_int64 value = 0;
+    const auto parsed = std::from_chars(id.data(), id.data() + id.length(), value);
+    if (parsed.ec != std::errc() || parsed.ptr != id.data() + id.length())
+    {
+      std::cout << "Data failed to insert to USERS table. Invalid ID = " << id << std::endl;
+      return false;
+    }
+    if (!loader.add(value, std::get<1>(user), std::get<2>(user))) return false;
+  }
+
+  return loader.commit();
 }
 
+/// <summary>
+/// split one CSV line into fields in place. fields may be quoted, with "" for a quote inside quotes.
+/// unquoted fields are views into line, quoted ones that need unescaping are rewritten inside line
+/// </summary>
+/// <returns>number of fields found, at most max_fields</returns>
+static size_t split_csv_line(std::string& line, std::string_view* fields, size_t max_fields)
+{
+  size_t count = 0;
+  size_t read = 0;
+  const size_t length = line.length();
 
-// DO NOT CHANGE
-void dump_results(const std::string& sql, const std::vector< user_record >& records)
+  while (count < max_fields)
+  {
+    if (read < length && line[read] == '"')
+    { // quoted, unescape into the same buffer, the output never gets ahead of the input
+      size_t write = ++read;
+      const size_t start = write;
+      while (read < length)
+      {
+        if (line[read] == '"')
+        {
+          if (read + 1 < length && line[read + 1] == '"')
+          {
+            line[write++] = '"';
+            read += 2;
+            continue;
+          }
+          ++read;
+          break;
+        }
+        line[write++] = line[read++];
+      }
+      fields[count++] = std::string_view(line.data() + start, write - start);
+      while (read < length && line[read] != ',') ++read;
+    }
+    else
+    {
+      const size_t start = read;
+      while (read < length && line[read] != ',') ++read;
+      fields[count++] = std::string_view(line.data() + start, read - start);
+    }
+
+    if (read >= length) break;
+    ++read; // the comma
+  }
+
+  return count;
+}
+
+/// <summary>
+/// bulk load USERS rows from a CSV stream of ID,NAME,PASSWORD lines. a first line whose ID is not a
+/// number is taken as a header and skipped, blank lines are ignored
+/// </summary>
+/// <param name="db">connection with a USERS table</param>
+/// <param name="input">CSV text</param>
+/// <param name="options">pragmas to load with</param>
+/// <param name="rows_loaded">rows inserted, 0 if the load was rolled back</param>
+/// <returns>true if every row was inserted</returns>
+bool bulk_load_users(sqlite3* db, std::istream& input, const bulk_load_options& options, size_t& rows_loaded)
 {
-  std::cout << std::endl << "SQL: " << sql << " ==> " << records.size() << " records found." << std::endl;
+  rows_loaded = 0;
+  users_bulk_loader loader(db);
+  if (!loader.begin(options)) return false;
 
-  for (auto record : records)
+  std::string line;
+  std::string_view fields[3]; // ID, NAME, PASSWORD
+  size_t line_number = 0;
+
+  while (std::getline(input, line))
   {
-    std::cout << "User: " << std::get<1>(record) << " [UID=" << std::get<0>(record) << " PWD=" << std::get<2>(record) << "]" << std::endl;
+    ++line_number;
+    if (!line.empty() && line.back() == '\r') line.pop_back();
+    if (line.empty()) continue;
+
+    if (split_csv_line(line, fields, 3) != 3)
+    {
+      std::cout << "Data failed to insert to USERS table. Expected ID,NAME,PASSWORD on line " << line_number << std::endl;
+      return false;
+    }
+
+    sqlite3_int64 id = 0;
+    const auto parsed = std::from_chars(fields[0].data(), fields[0].data() + fields[0].length(), id);
+    if (parsed.ec != std::errc() || parsed.ptr != fields[0].data() + fields[0].length())
+    {
+      if (line_number == 1) continue; // header
+      std::cout << "Data failed to insert to USERS table. Invalid ID on line " << line_number << std::endl;
+      return false;
+    }
+
+    if (!loader.add(id, fields[1], fields[2])) return false;
   }
+
+  if (!loader.commit()) return false;
+  rows_loaded = loader.rows();
+  return true;
 }
 
-// DO NOT CHANGE
-void run_queries(sqlite3* db)
+// how many compiled statements each connection keeps around
+const size_t statement_cache_capacity = 64;
+
+/// <summary>
+/// least recently used cache of prepared statements for one connection, keyed by normalized SQL,
+/// so running the same statement again skips sqlite's parse and plan step
+/// </summary>
+class statement_cache
 {
-  char* error_message = NULL;
+public:
+  explicit statement_cache(sqlite3* db, size_t capacity = statement_cache_capacity)
+    : db_(db), capacity_(capacity)
+  {
+  }
 
-  std::vector< user_record > records;
+  statement_cache(const statement_cache&) = delete;
+  statement_cache& operator=(const statement_cache&) = delete;
 
-  // query all
-  std::string sql = "SELECT * from USERS";
-  if (!run_query(db, sql, records)) return;
-  dump_results(sql, records);
+  ~statement_cache()
+  {
+    for (auto& entry : lru_)
+    {
+      sqlite3_finalize(entry.second);
+    }
+  }
 
-  //  query 1
-  sql = "SELECT ID, NAME, PASSWORD FROM USERS WHERE NAME='Fred'";
-  if (!run_query(db, sql, records)) return;
-  dump_results(sql, records);
+  /// <summary>
+  /// get a compiled statement for sql, ready to bind and step. call sqlite3_reset when done
+  /// with it so it does not hold a read transaction open
+  /// </summary>
+  /// <param name="sql">a single SQL statement</param>
+  /// <param name="tail">set to any text after the first statement, callers can refuse multi-statement sql</param>
+  /// <returns>the statement, or NULL if it does not compile (see sqlite3_errmsg)</returns>
+  sqlite3_stmt* acquire(const std::string& sql, std::string* tail = NULL)
+  {
+    const std::string key = normalize(sql);
 
-  //  run query 1 with injection 5 times
-  for (auto i = 0; i < 5; ++i)
+    auto found = index_.find(key);
+    if (found != index_.end())
+    { // most recently used goes to the front
+      lru_.splice(lru_.begin(), lru_, found->second);
+      ++hits_;
+      if (tail != NULL) tail->clear();
+      sqlite3_clear_bindings(found->second->second);
+      return found->second->second;
+    }
+
+    ++misses_;
+    sqlite3_stmt* statement = NULL;
+    const char* sql_tail = NULL;
+    if (sqlite3_prepare_v3(db_, key.c_str(), static_cast<int>(key.length()) + 1, SQLITE_PREPARE_PERSISTENT, &statement, &sql_tail) != SQLITE_OK)
+    {
+      return NULL;
+    }
+
+    if (tail != NULL) tail->assign(sql_tail != NULL ? sql_tail : "");
+    if (statement == NULL)
+    { // only whitespace or comments, nothing to run
+      return NULL;
+    }
+    if (sql_tail != NULL && *sql_tail != '\0')
+    { // more than one statement, do not cache a handle that only runs the first
+      uncached_.push_back(statement);
+      return statement;
+    }
+
+    if (lru_.size() >= capacity_)
+    {
+      sqlite3_finalize(lru_.back().second);
+      index_.erase(lru_.back().first);
+      lru_.pop_back();
+    }
+    lru_.emplace_front(key, statement);
+    index_[key] = lru_.begin();
+    return statement;
+  }
+
+  /// <summary>
+  /// finalize a handle acquire() returned for multi-statement sql, cached handles are left alone
+  /// </summary>
+  void release_uncached(sqlite3_stmt* statement)
   {
-    if (!run_query_injection(db, sql, records)) continue;
-    dump_results(sql, records);
+    auto found = std::find(uncached_.begin(), uncached_.end(), statement);
+    if (found != uncached_.end())
+    {
+      sqlite3_finalize(statement);
+      uncached_.erase(found);
+    }
+  }
+
+  size_t size() const { return lru_.size(); }
+  size_t hits() const { return hits_; }
+  size_t misses() const { return misses_; }
+
+  /// <summary>
+  /// collapse runs of whitespace outside quotes and comments to one space and drop leading / trailing
+  /// whitespace and semicolons, so trivially different spellings of one statement share a cache entry
+  /// </summary>
+  /// <param name="sql">sql text</param>
+  /// <returns>normalized sql text</returns>
+  static std::string normalize(const std::string& sql)
+  {
+    std::string result;
+    result.reserve(sql.length());
+
+    char quote = '\0';
+    size_t comment_start = 0;
+    bool pending_space = false;
+    for (size_t i = 0; i < sql.length(); ++i)
+    {
+      const char c = sql[i];
+      if (quote != '\0')
+      { // copy quoted text and comments untouched, a -- comment ends at (and keeps) its newline
+        result.push_back(c);
+        if (quote == '*')
+        {
+          if (c == '/' && result.length() >= comment_start + 4 && result[result.length() - 2] == '*') quote = '\0';
+        }
+        else if (c == quote)
+        {
+          quote = '\0';
+        }
+        continue;
+      }
+
+      if (c == '-' && i + 1 < sql.length() && sql[i + 1] == '-')
+      {
+        quote = '\n';
+      }
+      else if (c == '/' && i + 1 < sql.length() && sql[i + 1] == '*')
+      {
+        if (pending_space) result.push_back(' ');
+        pending_space = false;
+        comment_start = result.length();
+        result.append("/*");
+        ++i;
+        quote = '*';
+        continue;
+      }
+
+      if (c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f' || c == '\v')
+      {
+        pending_space = !result.empty();
+        continue;
+      }
+
+      if (pending_space)
+      {
+        result.push_back(' ');
+        pending_space = false;
+      }
+      if (c == '\'' || c == '"' || c == '`')
+      {
+        quote = c;
+      }
+      else if (c == '[')
+      {
+        quote = ']';
+      }
+      result.push_back(c);
+    }
+
+    while (!result.empty() && (result.back() == ';' || result.back() == ' '))
+    {
+      result.pop_back();
+    }
+
+    return result;
+  }
+
+private:
+  sqlite3* db_;
+  size_t capacity_;
+  std::list< std::pair<std::string, sqlite3_stmt*> > lru_;
+  std::unordered_map< std::string, std::list< std::pair<std::string, sqlite3_stmt*> >::iterator > index_;
+  // multi-statement handles are not cached, but are kept here so they are finalized with the cache
+  std::vector< sqlite3_stmt* > uncached_;
+  size_t hits_ = 0;
+  size_t misses_ = 0;
+};
+
+// statement caches by connection, so run_query(db, ...) callers get caching without passing one around
+static std::mutex statement_caches_mutex;
+static std::unordered_map< sqlite3*, std::unique_ptr<statement_cache> > statement_caches;
+
+/// <summary>
+/// get (creating if needed) the statement cache for a connection
+/// </summary>
+statement_cache& get_statement_cache(sqlite3* db)
+{
+  std::lock_guard<std::mutex> lock(statement_caches_mutex);
+  auto& cache = statement_caches[db];
+  if (!cache)
+  {
+    cache.reset(new statement_cache(db));
   }
+  return *cache;
+}
 
+/// <summary>
+/// finalize the cached statements of a connection, must be called before sqlite3_close
+/// </summary>
+void release_statement_cache(sqlite3* db)
+{
+  std::lock_guard<std::mutex> lock(statement_caches_mutex);
+  statement_caches.erase(db);
 }
 
-// You can change main by adding stuff to it, but all of the existing code must remain, and be in the
-// in the order called, and with none of this existing code placed into conditional statements
-int main()
+/// <summary>
+/// rows of a USERS query (ID, NAME, PASSWORD, the same columns as user_record) with all of the text
+/// in one arena. cells are offsets into the arena, so growing it never invalidates anything, and clear()
+/// keeps the capacity so a reused result set stops allocating once it has seen its largest query.
+/// the string_views handed out are valid until the result set is next changed
+/// </summary>
+class result_set
 {
-  // initialize random seed:
-  srand(time(nullptr));
+public:
+  static const int columns = 3;
 
-  int return_code = 0;
-  std::cout << "SQL Injection Example" << std::endl;
+  /// <summary>
+  /// make room up front so filling the set costs at most these two allocations
+  /// </summary>
+  /// <param name="rows">expected rows</param>
+  /// <param name="bytes_per_row">expected text bytes per row</param>
+  void reserve(size_t rows, size_t bytes_per_row = 32)
+  {
+    cells_.reserve(rows * columns);
+    arena_.reserve(rows * bytes_per_row);
+  }
 
-  // the database handle
-  sqlite3* db = NULL;
-  char* error_message = NULL;
+  void clear()
+  {
+    cells_.clear();
+    arena_.clear();
+  }
 
-  // open the database connection
-  int result = sqlite3_open(":memory:", &db);
+  /// <summary>
+  /// append the current row of a statement, missing or NULL columns are stored empty
+  /// </summary>
+  void add_row(sqlite3_stmt* statement)
+  {
+    const int count = sqlite3_column_count(statement);
+    for (int column = 0; column < columns; ++column)
+    {
+      const unsigned char* text = column < count ? sqlite3_column_text(statement, column) : NULL;
+      const int length = column < count ? sqlite3_column_bytes(statement, column) : 0;
+      append(reinterpret_cast<const char*>(text), text != NULL ? static_cast<size_t>(length) : 0);
+    }
+  }
 
-  if(result != SQLITE_OK)
+  /// <summary>
+  /// append a row as sqlite3_exec passes it to a callback
+  /// </summary>
+  void add_row(int argc, char** argv)
   {
-    std::cout << "Failed to connect to the database and terminating. ERROR=" << sqlite3_errmsg(db) << std::endl;
-    return -1;
+    for (int column = 0; column < columns; ++column)
+    {
+      const char* text = column < argc ? argv[column] : NULL;
+      append(text, text != NULL ? std::char_traits<char>::length(text) : 0);
+    }
   }
 
-  std::cout << "Connected to the database." << std::endl;
+  size_t size() const { return cells_.size() / columns; }
+  bool empty() const { return cells_.empty(); }
 
-  // initialize our database
-  if(!initialize_database(db))
+  std::string_view get(size_t row, int column) const
   {
-    std::cout << "Database Initialization Failed. Terminating." << std::endl;
-    return_code = -1;
+    const cell& found = cells_[row * columns + column];
+    return std::string_view(arena_.data() + found.offset, found.length);
   }
-  else
+
+  std::string_view id(size_t row) const { return get(row, 0); }
+  std::string_view name(size_t row) const { return get(row, 1); }
+  std::string_view password(size_t row) const { return get(row, 2); }
+
+private:
+  struct cell
   {
-    run_queries(db);
+    size_t offset;
+    size_t length;
+  };
+
+  void append(const char* text, size_t length)
+  {
+    cells_.push_back(cell{ arena_.size(), length });
+    arena_.insert(arena_.end(), text, text + length);
+  }
+
+  std::vector<char> arena_;
+  std::vector<cell> cells_;
+};
+
+// rows to make room for the first time a result set is used, later queries reuse what it grew to
+const size_t result_set_initial_rows = 64;
+
+/// <summary>
+/// sqlite3_exec callback that collects rows into a result_set
+/// </summary>
+static int result_set_callback(void* possible_result_set, int argc, char** argv, char** /*azColName*/)
+{
+  static_cast<result_set*>(possible_result_set)->add_row(argc, argv);
+  return 0;
+}
+
+/// <summary>
+/// add the current row of a statement to a vector, the same way callback does
+/// </summary>
+static void add_row(sqlite3_stmt* statement, std::vector< user_record >& records)
+{
+  const int columns = sqlite3_column_count(statement);
+  auto column_text = [&](int column)
+  {
+    const unsigned char* text = column < columns ? sqlite3_column_text(statement, column) : NULL;
+    return std::string(text != NULL ? reinterpret_cast<const char*>(text) : "");
+  };
+  records.push_back(std::make_tuple(column_text(0), column_text(1), column_text(2)));
+}
+
+static void add_row(sqlite3_stmt* statement, result_set& results)
+{
+  results.add_row(statement);
+}
+
+bool fingerprint_sql(std::string_view sql, std::string& shape);
+
+// lets maps keyed by std::string be searched with a string_view without building a key
+struct shape_hash
+{
+  using is_transparent = void;
+  size_t operator()(std::string_view shape) const { return std::hash<std::string_view>()(shape); }
+};
+
+/// <summary>
+/// latency histogram with four buckets per power of two, so percentiles read from it are within
+/// 25% of the real value from a nanosecond up to centuries, in 2 KiB
+/// </summary>
+class latency_histogram
+{
+public:
+  static const int bucket_count = 256;
+
+  void add(uint64_t nanoseconds)
+  {
+    ++buckets_[bucket_of(nanoseconds)];
+    ++count_;
+    total_ += nanoseconds;
+    max_ = std::max(max_, nanoseconds);
   }
 
+  /// <summary>
+  /// the latency fraction of samples are at or under, e.g. 0.99 for p99, as its bucket's upper bound
+  /// </summary>
+  uint64_t percentile(double fraction) const
+  {
+    const uint64_t wanted = static_cast<uint64_t>(fraction * static_cast<double>(count_) + 0.5);
+    uint64_t seen = 0;
+    for (int bucket = 0; bucket < bucket_count; ++bucket)
+    {
+      seen += buckets_[bucket];
+      if (seen >= wanted && seen > 0) return std::min(max_, lower_bound(bucket + 1) - 1);
+    }
+    return max_;
+  }
+
+  uint64_t count() const { return count_; }
+  uint64_t total() const { return total_; }
+  uint64_t max() const { return max_; }
+  double mean() const { return count_ > 0 ? static_cast<double>(total_) / static_cast<double>(count_) : 0.0; }
+
+private:
+  // the top bit picks the power of two and the two bits under it the quarter
+  static int bucket_of(uint64_t value)
+  {
+    if (value < 4) return static_cast<int>(value);
+    const int top = static_cast<int>(std::bit_width(value)) - 1;
+    return (top - 1) * 4 + static_cast<int>((value >> (top - 2)) & 3);
+  }
+
+  static uint64_t lower_bound(int bucket)
+  {
+    if (bucket < 4) return static_cast<uint64_t>(bucket);
+    if (bucket >= bucket_count) return UINT64_MAX;
+    return static_cast<uint64_t>(4 + bucket % 4) << (bucket / 4 - 1);
+  }
+
+  std::array<uint64_t, bucket_count> buckets_{};
+  uint64_t count_ = 0;
+  uint64_t total_ = 0;
+  uint64_t max_ = 0;
+};
+
+/// <summary>
+/// per phase latency histograms and row counts for each statement shape (see fingerprint_sql), so
+/// the same query with different values is one line in the report. screen, prepare, step and
+/// materialize are timed by run_query itself. execute is sqlite's own measure from the profile hook
+/// (sqlite3_trace_v2), only as fine as the VFS clock (milliseconds on most builds) but it covers every
+/// statement on an attached connection, cursors and the bulk loader included. while disabled the cost
+/// to run_query is one relaxed atomic load per call
+/// </summary>
+class query_stats
+{
+public:
+  enum phase { screen, prepare, step, materialize, execute, phase_count };
+
+  static const char* phase_name(int which)
+  {
+    static const char* const names[phase_count] = { "screen", "prepare", "step", "materialize", "execute" };
+    return names[which];
+  }
+
+  struct statement_stats
+  {
+    std::array<latency_histogram, phase_count> phases;
+    uint64_t calls = 0;
+    uint64_t rows = 0;
+  };
+
+  void enable(bool on) { enabled_.store(on, std::memory_order_relaxed); }
+  bool enabled() const { return enabled_.load(std::memory_order_relaxed); }
+
+  /// <summary>
+  /// have sqlite report each statement's run time on this connection, call before closing it or
+  /// detach() first. a connection has one trace hook, this replaces any other
+  /// </summary>
+  void attach(sqlite3* db)
+  {
+    sqlite3_trace_v2(db, SQLITE_TRACE_PROFILE, trace_callback, this);
+  }
+
+  void detach(sqlite3* db)
+  {
+    sqlite3_trace_v2(db, 0, NULL, NULL);
+  }
+
+  /// <summary>
+  /// add one run of sql: the phases in timed (a bit per phase) and the rows it returned
+  /// </summary>
+  void record(std::string_view sql, const std::array<uint64_t, phase_count>& nanoseconds, unsigned timed, uint64_t rows)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    statement_stats& found = find(sql);
+    for (int which = 0; which < phase_count; ++which)
+    {
+      if (timed & (1u << which)) found.phases[which].add(nanoseconds[which]);
+    }
+    ++found.calls;
+    found.rows += rows;
+  }
+
+  void reset()
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    statements_.clear();
+  }
+
+  /// <summary>
+  /// write a table of every shape seen, the one with the most time spent in it first
+  /// </summary>
+  void dump(std::ostream& output) const
+  {
+    std::vector< std::pair<std::string, statement_stats> > copies;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      copies.assign(statements_.begin(), statements_.end());
+    }
+    const auto time_in = [](const statement_stats& stats)
+    {
+      uint64_t total = 0;
+      for (const auto& histogram : stats.phases) total += histogram.total();
+      return total;
+    };
+    std::sort(copies.begin(), copies.end(), [&](const auto& left, const auto& right) { return time_in(left.second) > time_in(right.second); });
+
+    const std::ios_base::fmtflags flags = output.flags();
+    const std::streamsize precision = output.precision();
+    output << std::endl << "Statement latency (" << copies.size() << " shapes, times in microseconds)" << std::endl;
+    for (const auto& entry : copies)
+    {
+      output << entry.first << std::endl << "  calls=" << entry.second.calls << " rows=" << entry.second.rows << std::endl;
+      output << "  " << std::left << std::setw(12) << "phase" << std::right << std::setw(10) << "count" << std::setw(12) << "mean"
+        << std::setw(12) << "p50" << std::setw(12) << "p99" << std::setw(12) << "max" << std::endl;
+      output << std::fixed << std::setprecision(1);
+      for (int which = 0; which < phase_count; ++which)
+      {
+        const latency_histogram& histogram = entry.second.phases[which];
+        if (histogram.count() == 0) continue;
+        output << "  " << std::left << std::setw(12) << phase_name(which) << std::right << std::setw(10) << histogram.count()
+          << std::setw(12) << histogram.mean() / 1000.0 << std::setw(12) << histogram.percentile(0.5) / 1000.0
+          << std::setw(12) << histogram.percentile(0.99) / 1000.0 << std::setw(12) << histogram.max() / 1000.0 << std::endl;
+      }
+      output.flags(flags);
+      output.precision(precision);
+    }
+  }
+
+private:
+  // caller holds mutex_
+  statement_stats& find(std::string_view sql)
+  {
+    thread_local std::string shape;
+    if (!fingerprint_sql(sql, shape)) shape.assign(sql);
+    // the statement cache drops trailing semicolons, so sqlite's copy of the sql may not have them
+    while (!shape.empty() && (shape.back() == ';' || shape.back() == ' ')) shape.pop_back();
+
+    auto found = statements_.find(std::string_view(shape));
+    if (found == statements_.end())
+    {
+      found = statements_.emplace(shape, statement_stats()).first;
+    }
+    return found->second;
+  }
+
+  static int trace_callback(unsigned type, void* context, void* statement, void* nanoseconds)
+  {
+    query_stats* stats = static_cast<query_stats*>(context);
+    if (type != SQLITE_TRACE_PROFILE || !stats->enabled()) return 0;
+
+    const char* sql = sqlite3_sql(static_cast<sqlite3_stmt*>(statement));
+    std::lock_guard<std::mutex> lock(stats->mutex_);
+    stats->find(sql != NULL ? sql : "").phases[execute].add(static_cast<uint64_t>(*static_cast<sqlite3_int64*>(nanoseconds)));
+    return 0;
+  }
+
+  std::atomic<bool> enabled_{ false };
+  mutable std::mutex mutex_;
+  std::unordered_map<std::string, statement_stats, shape_hash, std::equal_to<>> statements_;
+};
+
+query_stats& get_query_stats()
+{
+  static query_stats stats;
+  return stats;
+}
+
+/// <summary>
+/// phase timings for one run of a statement, added to query_stats when it goes out of scope. does
+/// nothing at all if stats were disabled when it was made
+/// </summary>
+class statement_timing
+{
+public:
+  explicit statement_timing(std::string_view sql)
+    : sql_(sql), enabled_(get_query_stats().enabled())
+  {
+  }
+
+  statement_timing(const statement_timing&) = delete;
+  statement_timing& operator=(const statement_timing&) = delete;
+
+  ~statement_timing()
+  {
+    if (enabled_ && timed_ != 0) get_query_stats().record(sql_, nanoseconds_, timed_, rows_);
+  }
+
+  bool enabled() const { return enabled_; }
+
+  void add(query_stats::phase which, std::chrono::steady_clock::duration elapsed)
+  {
+    nanoseconds_[which] += static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+    timed_ |= 1u << which;
+  }
+
+  void add_rows(uint64_t rows) { rows_ += rows; }
+
+  /// <summary>
+  /// run work, timing it as phase which when enabled
+  /// </summary>
+  template <typename Work>
+  auto time(query_stats::phase which, Work&& work)
+  {
+    if (!enabled_) return work();
+    const auto start_time = std::chrono::steady_clock::now();
+    auto result = work();
+    add(which, std::chrono::steady_clock::now() - start_time);
+    return result;
+  }
+
+private:
+  std::string_view sql_;
+  bool enabled_;
+  std::array<uint64_t, query_stats::phase_count> nanoseconds_{};
+  unsigned timed_ = 0;
+  uint64_t rows_ = 0;
+};
+
+/// <summary>
+/// print query_stats every interval from a background thread until destroyed
+/// </summary>
+class query_stats_reporter
+{
+public:
+  query_stats_reporter(std::ostream& output, std::chrono::seconds interval)
+    : output_(output), interval_(interval), thread_([this]() { run(); })
+  {
+  }
+
+  query_stats_reporter(const query_stats_reporter&) = delete;
+  query_stats_reporter& operator=(const query_stats_reporter&) = delete;
+
+  ~query_stats_reporter()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopping_ = true;
+    }
+    stop_.notify_one();
+    thread_.join();
+  }
+
+private:
+  void run()
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!stop_.wait_for(lock, interval_, [this]() { return stopping_; }))
+    {
+      get_query_stats().dump(output_);
+    }
+  }
+
+  std::ostream& output_;
+  std::chrono::seconds interval_;
+  std::mutex mutex_;
+  std::condition_variable stop_;
+  bool stopping_ = false;
+  std::thread thread_;
+};
+
+/// <summary>
+/// step a prepared statement to completion, collecting the rows
+/// </summary>
+/// <returns>true if the statement ran to completion</returns>
+template <typename Rows>
+static bool step_statement(sqlite3_stmt* statement, Rows& rows)
+{
+  int result;
+  while ((result = sqlite3_step(statement)) == SQLITE_ROW)
+  {
+    add_row(statement, rows);
+  }
+  return result == SQLITE_DONE;
+}
+
+/// <summary>
+/// step_statement that also times sqlite3_step and the row copies separately when timing is enabled
+/// </summary>
+template <typename Rows>
+static bool step_statement(sqlite3_stmt* statement, Rows& rows, statement_timing& timing)
+{
+  if (!timing.enabled()) return step_statement(statement, rows);
+
+  // two clock reads a row: the step time is the whole loop less the time spent copying rows
+  std::chrono::steady_clock::duration materialize{ 0 };
+  uint64_t count = 0;
+  const auto start_time = std::chrono::steady_clock::now();
+  int result;
+  while ((result = sqlite3_step(statement)) == SQLITE_ROW)
+  {
+    const auto row_start = std::chrono::steady_clock::now();
+    add_row(statement, rows);
+    materialize += std::chrono::steady_clock::now() - row_start;
+    ++count;
+  }
+  timing.add(query_stats::step, std::chrono::steady_clock::now() - start_time - materialize);
+  timing.add(query_stats::materialize, materialize);
+  timing.add_rows(count);
+  return result == SQLITE_DONE;
+}
+
+/// <summary>
+/// run sql that has already been screened: single statements through the connection's statement
+/// cache, anything else (several statements, or sql that did not compile) through sqlite3_exec
+/// </summary>
+/// <param name="db">connection to run on</param>
+/// <param name="sql">sql to run</param>
+/// <param name="rows">rows returned</param>
+/// <param name="exec_callback">callback that adds a row to rows for the sqlite3_exec path</param>
+/// <param name="timing">phase timings for query_stats</param>
+/// <returns>true if the query ran</returns>
+template <typename Rows>
+static bool execute_query(sqlite3* db, const std::string& sql, Rows& rows, int (*exec_callback)(void*, int, char**, char**), statement_timing& timing)
+{
+  // single statements run through the connection's statement cache, repeats skip the compile step
+  statement_cache& cache = get_statement_cache(db);
+  std::string tail;
+  sqlite3_stmt* statement = timing.time(query_stats::prepare, [&]() { return cache.acquire(sql, &tail); });
+  if (statement != NULL && tail.empty())
+  {
+    const bool ok = step_statement(statement, rows, timing);
+    if (!ok)
+    {
+      std::cout << "Data failed to be queried from USERS table. ERROR = " << sqlite3_errmsg(db) << std::endl;
+    }
+    sqlite3_reset(statement);
+    return ok;
+  }
+  cache.release_uncached(statement);
+
+  // sqlite3_exec prepares, steps and calls back in one go, so it is all counted as step
+  char* error_message;
+  const size_t rows_before = rows.size();
+  const int result = timing.time(query_stats::step, [&]() { return sqlite3_exec(db, sql.c_str(), exec_callback, &rows, &error_message); });
+  timing.add_rows(rows.size() - rows_before);
+  if(result != SQLITE_OK)
+  {
+    std::cout << "Data failed to be queried from USERS table. ERROR = " << error_message << std::endl;
+    sqlite3_free(error_message);
+    return false;
+  }
+
+  return true;
+}
+
+/// <summary>
+/// run a cached prepared statement with ? parameters bound as text
+/// </summary>
+template <typename Rows>
+static bool execute_bound_query(sqlite3* db, const std::string& sql, const std::vector<std::string>& parameters, Rows& rows)
+{
+  statement_timing timing(sql);
+  statement_cache& cache = get_statement_cache(db);
+  std::string tail;
+  sqlite3_stmt* statement = timing.time(query_stats::prepare, [&]() { return cache.acquire(sql, &tail); });
+  if (statement == NULL || !tail.empty())
+  {
+    std::cout << "Data failed to be queried from USERS table. ERROR = " << (statement == NULL ? sqlite3_errmsg(db) : "only one statement is allowed") << std::endl;
+    cache.release_uncached(statement);
+    return false;
+  }
+
+  if (static_cast<int>(parameters.size()) != sqlite3_bind_parameter_count(statement))
+  {
+    std::cout << "Data failed to be queried from USERS table. ERROR = wrong number of parameters" << std::endl;
+    return false;
+  }
+  for (size_t i = 0; i < parameters.size(); ++i)
+  {
+    sqlite3_bind_text(statement, static_cast<int>(i + 1), parameters[i].c_str(), static_cast<int>(parameters[i].length()), SQLITE_TRANSIENT);
+  }
+
+  const bool ok = step_statement(statement, rows, timing);
+  if (!ok)
+  {
+    std::cout << "Data failed to be queried from USERS table. ERROR = " << sqlite3_errmsg(db) << std::endl;
+  }
+  sqlite3_reset(statement);
+
+  return ok;
+}
+
+/// <summary>
+/// run a cached prepared statement with ? parameters bound as text. values never become part of the
+/// SQL text, so this path needs no injection screening
+/// </summary>
+/// <param name="db">connection to run on</param>
+/// <param name="sql">a single SQL statement with ? placeholders</param>
+/// <param name="parameters">values for the placeholders, in order</param>
+/// <param name="records">rows returned</param>
+/// <returns>true if the query ran</returns>
+bool run_query(sqlite3* db, const std::string& sql, const std::vector<std::string>& parameters, std::vector< user_record >& records)
+{
+  records.clear();
+  return execute_bound_query(db, sql, parameters, records);
+}
+
+/// <summary>
+/// run_query with bound parameters into an arena backed result set
+/// </summary>
+bool run_query(sqlite3* db, const std::string& sql, const std::vector<std::string>& parameters, result_set& results)
+{
+  results.clear();
+  results.reserve(result_set_initial_rows); // no-op once the set has grown past this
+  return execute_bound_query(db, sql, parameters, results);
+}
+
+/// <summary>
+/// kinds of token the injection screen cares about
+/// </summary>
+enum class sql_token_type
+{
+  end,
+  word,                 // keyword or bare identifier
+  number,
+  string,               // '...' literal
+  quoted_identifier,    // "...", `...` or [...]
+  comparison,           // = == != <> < > <= >=
+  symbol,               // any other operator or punctuation
+  open_paren,
+  semicolon,
+  unterminated          // a literal, quoted identifier or comment that never closes
+};
+
+struct sql_token
+{
+  sql_token_type type;
+  std::string_view text;
+};
+
+/// <summary>
+/// splits sql into tokens without copying or allocating. whitespace and comments are skipped,
+/// literals are returned whole so their contents are never mistaken for sql
+/// </summary>
+class sql_lexer
+{
+public:
+  explicit sql_lexer(std::string_view sql)
+    : sql_(sql)
+  {
+  }
+
+  sql_token next()
+  {
+    after_comment_ = false;
+    if (!skip_space_and_comments())
+    {
+      return token(sql_token_type::unterminated, sql_.length());
+    }
+    if (position_ >= sql_.length())
+    {
+      return sql_token{ sql_token_type::end, std::string_view() };
+    }
+
+    const size_t start = position_;
+    const char c = sql_[position_];
+
+    if (is_word_start(c))
+    {
+      // X'..' blob literals are a word character followed by a string, lex them as strings
+      if ((c == 'x' || c == 'X') && position_ + 1 < sql_.length() && sql_[position_ + 1] == '\'')
+      {
+        ++position_;
+        return quoted(start, '\'', sql_token_type::string);
+      }
+      while (position_ < sql_.length() && is_word_part(sql_[position_])) ++position_;
+      return token(sql_token_type::word, start);
+    }
+    if (is_digit(c) || (c == '.' && position_ + 1 < sql_.length() && is_digit(sql_[position_ + 1])))
+    {
+      while (position_ < sql_.length() && (is_word_part(sql_[position_]) || sql_[position_] == '.' ||
+        ((sql_[position_] == '+' || sql_[position_] == '-') && (sql_[position_ - 1] == 'e' || sql_[position_ - 1] == 'E'))))
+      {
+        ++position_;
+      }
+      return token(sql_token_type::number, start);
+    }
+
+    switch (c)
+    {
+    case '\'': return quoted(start, '\'', sql_token_type::string);
+    case '"': return quoted(start, '"', sql_token_type::quoted_identifier);
+    case '`': return quoted(start, '`', sql_token_type::quoted_identifier);
+    case '[': return quoted(start, ']', sql_token_type::quoted_identifier);
+    case ';': ++position_; return token(sql_token_type::semicolon, start);
+    case '(': ++position_; return token(sql_token_type::open_paren, start);
+    case '=':
+      position_ += (position_ + 1 < sql_.length() && sql_[position_ + 1] == '=') ? 2 : 1;
+      return token(sql_token_type::comparison, start);
+    case '<': case '>': case '!':
+      ++position_;
+      if (position_ < sql_.length() && (sql_[position_] == '=' || (c == '<' && sql_[position_] == '>')))
+      {
+        ++position_;
+      }
+      return token(c == '!' && position_ - start == 1 ? sql_token_type::symbol : sql_token_type::comparison, start);
+    default:
+      ++position_;
+      return token(sql_token_type::symbol, start);
+    }
+  }
+
+private:
+  enum : unsigned char { word_start = 1, word_part = 2, digit = 4, space = 8 };
+
+  // one table lookup per character instead of a chain of range checks
+  static constexpr std::array<unsigned char, 256> character_classes = []()
+  {
+    std::array<unsigned char, 256> classes{};
+    for (int c = 0; c < 256; ++c)
+    {
+      if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_' || c >= 0x80) classes[c] = word_start | word_part;
+      if (c >= '0' && c <= '9') classes[c] = word_part | digit;
+      if (c == '$') classes[c] = word_part;
+      if (c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f' || c == '\v') classes[c] = space;
+    }
+    return classes;
+  }();
+
+public:
+  static bool is_digit(char c) { return (character_classes[static_cast<unsigned char>(c)] & digit) != 0; }
+  static bool is_word_start(char c) { return (character_classes[static_cast<unsigned char>(c)] & word_start) != 0; }
+  static bool is_word_part(char c) { return (character_classes[static_cast<unsigned char>(c)] & word_part) != 0; }
+  static bool is_space(char c) { return (character_classes[static_cast<unsigned char>(c)] & space) != 0; }
+
+  // true if a comment was skipped in front of the token next() last returned
+  bool after_comment() const { return after_comment_; }
+
+private:
+
+  sql_token token(sql_token_type type, size_t start)
+  {
+    return sql_token{ type, sql_.substr(start, position_ - start) };
+  }
+
+  // a doubled closing quote inside the literal is an escaped quote, not the end
+  sql_token quoted(size_t start, char close, sql_token_type type)
+  {
+    ++position_;
+    while (position_ < sql_.length())
+    {
+      if (sql_[position_++] == close)
+      {
+        if (close != ']' && position_ < sql_.length() && sql_[position_] == close)
+        {
+          ++position_;
+          continue;
+        }
+        return token(type, start);
+      }
+    }
+    return token(sql_token_type::unterminated, start);
+  }
+
+  // false if a block comment never closes
+  bool skip_space_and_comments()
+  {
+    while (position_ < sql_.length())
+    {
+      const char c = sql_[position_];
+      if (is_space(c))
+      {
+        ++position_;
+      }
+      else if (c == '-' && position_ + 1 < sql_.length() && sql_[position_ + 1] == '-')
+      {
+        after_comment_ = true;
+        while (position_ < sql_.length() && sql_[position_] != '\n') ++position_;
+      }
+      else if (c == '/' && position_ + 1 < sql_.length() && sql_[position_ + 1] == '*')
+      {
+        after_comment_ = true;
+        const size_t close = sql_.find("*/", position_ + 2);
+        if (close == std::string_view::npos)
+        {
+          position_ = sql_.length();
+          return false;
+        }
+        position_ = close + 2;
+      }
+      else
+      {
+        break;
+      }
+    }
+    return true;
+  }
+
+  std::string_view sql_;
+  size_t position_ = 0;
+  bool after_comment_ = false;
+};
+
+/// <summary>
+/// what the injection screen found
+/// </summary>
+enum class injection_verdict
+{
+  clean,
+  tautology,            // OR followed by a condition that does not depend on the row, e.g. OR 2=2, OR 'a'='a', OR ID=ID
+  unclassified_or,      // OR followed by a condition the screen cannot show depends on the row, e.g. OR ID > 0
+  stacked_statements,   // a second statement after a semicolon
+  union_query,          // UNION, which appends rows from any table the connection can read
+  comment_after_string, // a comment after a string literal, typical of input cutting off the rest of the query
+  unterminated_literal  // a quote or comment that never closes, typical of input breaking out of a literal
+};
+
+// ascii only, which is all sql keywords need
+static bool equals_ignore_case(std::string_view left, std::string_view right)
+{
+  if (left.length() != right.length()) return false;
+  const auto lower = [](char c) { return (c >= 'A' && c <= 'Z') ? static_cast<char>(c - 'A' + 'a') : c; };
+  for (size_t i = 0; i < left.length(); ++i)
+  {
+    if (lower(left[i]) != lower(right[i])) return false;
+  }
+  return true;
+}
+
+static bool is_constant(const sql_token& token)
+{
+  return token.type == sql_token_type::number || token.type == sql_token_type::string ||
+    (token.type == sql_token_type::word && (equals_ignore_case(token.text, "true") || equals_ignore_case(token.text, "false") || equals_ignore_case(token.text, "null")));
+}
+
+// a number other than zero, TRUE, or a string with anything in it
+static bool is_truthy_constant(const sql_token& token)
+{
+  if (token.type == sql_token_type::word) return equals_ignore_case(token.text, "true");
+  if (token.type == sql_token_type::string) return token.text.length() - token.text.find('\'') > 2; // X'..' blobs included
+  if (token.type != sql_token_type::number) return false;
+  return token.text.find_first_of("123456789") != std::string_view::npos;
+}
+
+static bool is_operand(const sql_token& token)
+{
+  return is_constant(token) || token.type == sql_token_type::word || token.type == sql_token_type::quoted_identifier;
+}
+
+static bool is_word(const sql_token& token, std::string_view keyword)
+{
+  return token.type == sql_token_type::word && equals_ignore_case(token.text, keyword);
+}
+
+// tokens that can sit in front of an operand without changing whether it is constant: ( NOT - +
+static bool is_operand_prefix(const sql_token& token)
+{
+  return token.type == sql_token_type::open_paren ||
+    (token.type == sql_token_type::symbol && (token.text == "-" || token.text == "+")) ||
+    is_word(token, "not");
+}
+
+// arithmetic, bitwise and || (two | tokens) between two operands
+static bool is_binary_operator(const sql_token& token)
+{
+  return token.type == sql_token_type::symbol && token.text.length() == 1 &&
+    std::string_view("+-*/%|&").find(token.text[0]) != std::string_view::npos;
+}
+
+static bool is_comparison(const sql_token& token)
+{
+  return token.type == sql_token_type::comparison ||
+    is_word(token, "is") || is_word(token, "like") || is_word(token, "glob");
+}
+
+/// <summary>
+/// one pass over the tokens of a statement looking for injection. anything that is not a literal,
+/// a comment or a well formed OR condition is passed over, so the screen never allocates
+/// </summary>
+class sql_screen
+{
+public:
+  explicit sql_screen(std::string_view sql)
+    : lexer_(sql)
+  {
+  }
+
+  injection_verdict run()
+  {
+    bool after_semicolon = false;
+    advance();
+    while (found_ == injection_verdict::clean && token_.type != sql_token_type::end)
+    {
+      if (token_.type == sql_token_type::semicolon)
+      {
+        after_semicolon = true;
+        advance();
+        continue;
+      }
+      if (after_semicolon) return injection_verdict::stacked_statements;
+      if (is_word(token_, "or"))
+      {
+        advance();
+        const injection_verdict verdict = screen_or_condition();
+        if (found_ == injection_verdict::clean) found_ = verdict;
+        continue; // the condition stopped on a token it did not use
+      }
+      advance();
+    }
+    return found_;
+  }
+
+private:
+  // what an operand of a condition turned out to be
+  struct operand
+  {
+    enum class kind { unknown, literal, column, expression } type = kind::unknown;
+    sql_token token = { sql_token_type::end, std::string_view() }; // the literal or column
+    bool negated = false; // an odd number of NOTs in front of it
+  };
+
+  // the next token, checking it for the problems that do not depend on where it is
+  void advance()
+  {
+    token_ = lexer_.next();
+    if (found_ != injection_verdict::clean) return;
+
+    if (token_.type == sql_token_type::unterminated) found_ = injection_verdict::unterminated_literal;
+    else if (lexer_.after_comment() && after_string_) found_ = injection_verdict::comment_after_string;
+    else if (is_word(token_, "union")) found_ = injection_verdict::union_query;
+    after_string_ = after_string_ || token_.type == sql_token_type::string;
+  }
+
+  // from an open paren to its close, or to the end of the statement
+  void skip_parenthesized()
+  {
+    size_t depth = 0;
+    do
+    {
+      if (token_.type == sql_token_type::open_paren) ++depth;
+      else if (token_.type == sql_token_type::symbol && token_.text == ")") --depth;
+      advance();
+    } while (depth > 0 && token_.type != sql_token_type::end);
+  }
+
+  // [( NOT - +]* term [operator [( NOT - +]* term]*, where a term is a literal, a column or a function call.
+  // anything with an operator or a call in it is taken to be constant, the screen does not evaluate it
+  operand read_operand()
+  {
+    operand result;
+    bool identifier = false;
+    bool compound = false;
+    for (;;)
+    {
+      for (; is_operand_prefix(token_); advance())
+      {
+        if (is_word(token_, "not")) result.negated = !result.negated;
+      }
+      if (!is_operand(token_)) return operand();
+
+      result.token = token_;
+      identifier = identifier || !is_constant(token_);
+      advance();
+      if (token_.type == sql_token_type::open_paren && result.token.type == sql_token_type::word)
+      {
+        compound = true; // function call, abs(1)
+        skip_parenthesized();
+      }
+      if (!is_binary_operator(token_)) break;
+
+      compound = true;
+      while (is_binary_operator(token_)) advance();
+    }
+
+    result.type = compound ? operand::kind::expression : identifier ? operand::kind::column : operand::kind::literal;
+    return result;
+  }
+
+  // the condition after an OR. the only conditions let through are a column compared equal to a
+  // literal and a literal that is false or null, everything else is a tautology or unclassified
+  injection_verdict screen_or_condition()
+  {
+    const operand left = read_operand();
+    if (left.type == operand::kind::unknown) return injection_verdict::unclassified_or;
+
+    if (!is_comparison(token_))
+    {
+      if (left.type != operand::kind::literal) return injection_verdict::unclassified_or;
+      if (is_word(left.token, "null")) return injection_verdict::clean; // NOT NULL is still NULL
+      return is_truthy_constant(left.token) != left.negated ? injection_verdict::tautology : injection_verdict::clean;
+    }
+
+    const sql_token comparison = token_;
+    advance();
+    const operand right = read_operand();
+    if (right.type == operand::kind::unknown) return injection_verdict::unclassified_or;
+
+    if (left.type != operand::kind::column && right.type != operand::kind::column) return injection_verdict::tautology;
+    if (left.type == operand::kind::column && right.type == operand::kind::column)
+    {
+      return left.token.type == right.token.type && equals_ignore_case(left.token.text, right.token.text) ?
+        injection_verdict::tautology : injection_verdict::unclassified_or;
+    }
+
+    const bool equality = comparison.text == "=" || comparison.text == "==";
+    const operand& other = left.type == operand::kind::column ? right : left;
+    return equality && !left.negated && !right.negated && other.type == operand::kind::literal ?
+      injection_verdict::clean : injection_verdict::unclassified_or;
+  }
+
+  sql_lexer lexer_;
+  sql_token token_ = { sql_token_type::end, std::string_view() };
+  bool after_string_ = false;
+  injection_verdict found_ = injection_verdict::clean;
+};
+
+/// <summary>
+/// screen a statement for injection in one pass over its tokens, without copying or allocating.
+/// string literals are skipped whole, so a name like 'Gregory or Greg' is fine, and the checks are
+/// on structure rather than spelling, so OR 2=2 is caught the same as OR 1=1. an OR is only let
+/// through when the condition after it plainly depends on the row, NAME='Barney', anything the
+/// screen cannot work out is flagged, as the original ' or ' check flagged every OR
+/// </summary>
+/// <param name="sql">sql to screen</param>
+/// <returns>the first problem found, or clean</returns>
+injection_verdict screen_sql(std::string_view sql)
+{
+  return sql_screen(sql).run();
+}
+
+/// <summary>
+/// reduce sql to its shape: literals are replaced, comments and extra whitespace dropped, and words
+/// lowercased, so the same query with different values gives the same shape. strings become '' or 'x'
+/// and numbers 0 or 1 by whether they are empty or zero, and the first comment after a string is kept
+/// as /**/, which is all screen_sql looks at, so the shape is itself sql that screens the same as the
+/// original
+/// </summary>
+/// <param name="sql">sql to fingerprint</param>
+/// <param name="shape">receives the shape, reused so a warm buffer does not allocate</param>
+/// <returns>false if a literal or comment never closes, the shape is incomplete</returns>
+bool fingerprint_sql(std::string_view sql, std::string& shape)
+{
+  // one pass over the characters using the lexer's rules for where literals, words and comments
+  // start and end, but without building tokens. characters outside literals are copied as they
+  // are, so operators keep their adjacency and the shape lexes into the same tokens as the original
+  const size_t length = sql.length();
+  shape.resize(length + 4); // a shape is never longer than its sql, give or take the one comment it keeps
+  char* out = shape.data();
+  bool pending_space = false;
+  bool after_string = false;
+  bool pending_comment = false; // a comment after a string, not written yet
+  bool comment_kept = false;
+  size_t i = 0;
+
+  // the screen stops at the first comment after a string, so one stands in for them all
+  const auto keep_comment = [&]()
+  {
+    if (!pending_comment || comment_kept) return;
+    for (const char marker : { '/', '*', '*', '/' }) *out++ = marker;
+    comment_kept = true;
+  };
+
+  const auto lower = [](char c) { return (c >= 'A' && c <= 'Z') ? static_cast<char>(c - 'A' + 'a') : c; };
+  // skips a quoted run starting at i, true if it closes
+  const auto skip_quoted = [&](char close)
+  {
+    for (++i; i < length; )
+    {
+      if (sql[i++] == close)
+      {
+        if (close != ']' && i < length && sql[i] == close)
+        {
+          ++i;
+          continue;
+        }
+        return true;
+      }
+    }
+    return false;
+  };
+
+  while (i < length)
+  {
+    const char c = sql[i];
+    if (sql_lexer::is_space(c))
+    {
+      pending_space = true;
+      ++i;
+      continue;
+    }
+    if (c == '-' && i + 1 < length && sql[i + 1] == '-')
+    {
+      while (i < length && sql[i] != '\n') ++i;
+      pending_space = true;
+      pending_comment = pending_comment || after_string;
+      continue;
+    }
+    if (c == '/' && i + 1 < length && sql[i + 1] == '*')
+    {
+      const size_t close = sql.find("*/", i + 2);
+      if (close == std::string_view::npos) return false;
+      i = close + 2;
+      pending_space = true;
+      pending_comment = pending_comment || after_string;
+      continue;
+    }
+
+    keep_comment();
+    if (pending_space && out != shape.data()) *out++ = ' ';
+    pending_space = false;
+
+    if (c == '\'' || ((c == 'x' || c == 'X') && i + 1 < length && sql[i + 1] == '\''))
+    {
+      if (c != '\'') ++i;
+      const size_t start = i;
+      if (!skip_quoted('\'')) return false;
+      if (out != shape.data() && out[-1] == '\'') *out++ = ' '; // after a dropped X, '''' would read as one string
+      *out++ = '\'';
+      if (i - start > 2) *out++ = 'x';
+      *out++ = '\'';
+      after_string = true;
+    }
+    else if (sql_lexer::is_word_start(c))
+    {
+      while (i < length && sql_lexer::is_word_part(sql[i])) *out++ = lower(sql[i++]);
+    }
+    else if (sql_lexer::is_digit(c) || (c == '.' && i + 1 < length && sql_lexer::is_digit(sql[i + 1])))
+    {
+      bool nonzero = false;
+      for (; i < length && (sql_lexer::is_word_part(sql[i]) || sql[i] == '.' ||
+        ((sql[i] == '+' || sql[i] == '-') && (sql[i - 1] == 'e' || sql[i - 1] == 'E'))); ++i)
+      {
+        nonzero |= sql[i] >= '1' && sql[i] <= '9';
+      }
+      if (c == '.' && out != shape.data() && sql_lexer::is_word_part(out[-1])) *out++ = ' '; // keeps ID.5 from becoming ID1
+      *out++ = nonzero ? '1' : '0';
+    }
+    else if (c == '"' || c == '`' || c == '[')
+    {
+      const size_t start = i;
+      if (!skip_quoted(c == '[' ? ']' : c)) return false;
+      for (size_t j = start; j < i; ++j) *out++ = lower(sql[j]);
+    }
+    else
+    {
+      *out++ = c;
+      ++i;
+    }
+  }
+  keep_comment();
+  shape.resize(out - shape.data());
+  return true;
+}
+
+/// <summary>
+/// screen_sql verdicts by query shape, shared by every thread. reads take a shared lock on one of
+/// several shards so concurrent lookups of different shapes do not contend
+/// </summary>
+class injection_verdict_cache
+{
+public:
+  static constexpr size_t shard_count = 16;
+  static constexpr size_t shard_capacity = 1024; // novel shapes past this are screened but not kept
+
+  bool find(std::string_view shape, injection_verdict& verdict) const
+  {
+    const shard& owner = shard_for(shape);
+    std::shared_lock<std::shared_mutex> lock(owner.mutex);
+    const auto found = owner.verdicts.find(shape);
+    if (found == owner.verdicts.end())
+    {
+      owner.misses.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    owner.hits.fetch_add(1, std::memory_order_relaxed);
+    verdict = found->second;
+    return true;
+  }
+
+  void insert(std::string_view shape, injection_verdict verdict)
+  {
+    shard& owner = shard_for(shape);
+    std::unique_lock<std::shared_mutex> lock(owner.mutex);
+    if (owner.verdicts.size() < shard_capacity)
+    {
+      owner.verdicts.emplace(shape, verdict);
+    }
+  }
+
+  void clear()
+  {
+    for (auto& owner : shards_)
+    {
+      std::unique_lock<std::shared_mutex> lock(owner.mutex);
+      owner.verdicts.clear();
+      owner.hits = 0;
+      owner.misses = 0;
+    }
+  }
+
+  size_t hits() const
+  {
+    size_t total = 0;
+    for (const auto& owner : shards_)
+    {
+      total += owner.hits.load(std::memory_order_relaxed);
+    }
+    return total;
+  }
+
+  size_t misses() const
+  {
+    size_t total = 0;
+    for (const auto& owner : shards_)
+    {
+      total += owner.misses.load(std::memory_order_relaxed);
+    }
+    return total;
+  }
+
+private:
+  // each shard on its own cache line, counters included, so lookups on different shards share nothing
+  struct alignas(64) shard
+  {
+    mutable std::shared_mutex mutex;
+    std::unordered_map<std::string, injection_verdict, shape_hash, std::equal_to<>> verdicts;
+    mutable std::atomic<size_t> hits{ 0 };
+    mutable std::atomic<size_t> misses{ 0 };
+  };
+
+  // the map buckets use the low bits of the hash, so fold the high half in before picking a shard.
+  // the shift is half the width of size_t, which keeps it defined for 32 bit builds too
+  static size_t shard_index(std::string_view shape)
+  {
+    const size_t hash = shape_hash()(shape);
+    return (hash ^ (hash >> (sizeof(size_t) * 4))) % shard_count;
+  }
+
+  shard& shard_for(std::string_view shape) { return shards_[shard_index(shape)]; }
+  const shard& shard_for(std::string_view shape) const { return shards_[shard_index(shape)]; }
+
+  std::array<shard, shard_count> shards_;
+};
+
+injection_verdict_cache& get_injection_verdict_cache()
+{
+  static injection_verdict_cache cache;
+  return cache;
+}
+
+/// <summary>
+/// screen_sql through the verdict cache: a shape seen before costs one fingerprint pass and a hash
+/// lookup, only a new shape runs the full screen
+/// </summary>
+injection_verdict screen_sql_cached(std::string_view sql)
+{
+  thread_local std::string shape;
+  if (!fingerprint_sql(sql, shape))
+  {
+    return screen_sql(sql); // no complete shape to cache, and screen_sql reports whichever problem comes first
+  }
+
+  injection_verdict_cache& cache = get_injection_verdict_cache();
+  injection_verdict verdict;
+  if (!cache.find(shape, verdict))
+  {
+    verdict = screen_sql(shape);
+    cache.insert(shape, verdict);
+  }
+  return verdict;
+}
+
+/// <summary>
+/// screen sql for a suspected injection
+/// </summary>
+/// <param name="sql">sql to check</param>
+/// <returns>true if the sql looks like it has been tampered with</returns>
+bool is_suspected_injection(const std::string& sql)
+{
+  return screen_sql_cached(sql) != injection_verdict::clean;
+}
+
+bool run_query(sqlite3* db, const std::string& sql, std::vector< user_record >& records)
+{
+  // TODO: Fix this method to fail and display an error if there is a suspected SQL Injection
+  //  NOTE: You cannot just flag 1=1 as an error, since 2=2 will work just as well. You need
+  //  something more generic
+
+  // clear any prior results
+  records.clear();
+
+  statement_timing timing(sql);
+  if (timing.time(query_stats::screen, [&]() { return is_suspected_injection(sql); })) {
+      // JR: string contains ' or '
+      std::cout << std::endl << "***POSSIBLE SQL INJECTION DETECTED***" << std::endl;
+      return false;
+  }
+
+  return execute_query(db, sql, records, callback, timing);
+}
+
+/// <summary>
+/// run_query into an arena backed result set instead of a vector of tuples, a large result costs
+/// a couple of allocations in total instead of several per row
+/// </summary>
+/// <param name="db">connection to run on</param>
+/// <param name="sql">sql to run</param>
+/// <param name="results">rows returned, reused across calls</param>
+/// <returns>true if the query ran</returns>
+bool run_query(sqlite3* db, const std::string& sql, result_set& results)
+{
+  results.clear();
+  results.reserve(result_set_initial_rows); // no-op once the set has grown past this
+
+  statement_timing timing(sql);
+  if (timing.time(query_stats::screen, [&]() { return is_suspected_injection(sql); })) {
+      std::cout << std::endl << "***POSSIBLE SQL INJECTION DETECTED***" << std::endl;
+      return false;
+  }
+
+  return execute_query(db, sql, results, result_set_callback, timing);
+}
+
+/// <summary>
+/// rows of a query read one at a time straight from sqlite3_step, so memory stays the same however
+/// many rows the query returns and the caller can stop whenever it likes. the cursor prepares its own
+/// statement rather than borrowing the connection's cached one, so it can stay open while run_query
+/// runs the same sql. the string_views it hands out are valid until the next call to next() or fetch()
+/// </summary>
+class query_cursor
+{
+public:
+  /// <summary>
+  /// open a cursor on sql, screened for injection the same way run_query does
+  /// </summary>
+  query_cursor(sqlite3* db, const std::string& sql)
+    : db_(db)
+  {
+    if (is_suspected_injection(sql))
+    {
+      std::cout << std::endl << "***POSSIBLE SQL INJECTION DETECTED***" << std::endl;
+      failed_ = true;
+      return;
+    }
+    prepare(sql);
+  }
+
+  /// <summary>
+  /// open a cursor on sql with ? parameters bound as text
+  /// </summary>
+  query_cursor(sqlite3* db, const std::string& sql, const std::vector<std::string>& parameters)
+    : db_(db)
+  {
+    if (!prepare(sql)) return;
+
+    if (static_cast<int>(parameters.size()) != sqlite3_bind_parameter_count(statement_))
+    {
+      std::cout << "Data failed to be queried from USERS table. ERROR = wrong number of parameters" << std::endl;
+      close();
+      failed_ = true;
+      return;
+    }
+    for (size_t i = 0; i < parameters.size(); ++i)
+    {
+      sqlite3_bind_text(statement_, static_cast<int>(i + 1), parameters[i].c_str(), static_cast<int>(parameters[i].length()), SQLITE_TRANSIENT);
+    }
+  }
+
+  query_cursor(const query_cursor&) = delete;
+  query_cursor& operator=(const query_cursor&) = delete;
+
+  query_cursor(query_cursor&& other) noexcept
+    : db_(other.db_), statement_(other.statement_), failed_(other.failed_)
+  {
+    other.statement_ = NULL;
+  }
+
+  ~query_cursor()
+  {
+    close();
+  }
+
+  /// <summary>
+  /// step to the next row
+  /// </summary>
+  /// <returns>true if there is a row, false at the end, after an error or once closed</returns>
+  bool next()
+  {
+    if (statement_ == NULL) return false;
+
+    const int result = sqlite3_step(statement_);
+    if (result == SQLITE_ROW) return true;
+    if (result != SQLITE_DONE)
+    {
+      std::cout << "Data failed to be queried from USERS table. ERROR = " << sqlite3_errmsg(db_) << std::endl;
+      failed_ = true;
+    }
+    close();
+    return false;
+  }
+
+  /// <summary>
+  /// read up to count rows into batch, replacing what it held. a result_set reused across calls stops
+  /// allocating after the first batch
+  /// </summary>
+  /// <returns>rows read, fewer than count only at the end of the rows</returns>
+  size_t fetch(result_set& batch, size_t count)
+  {
+    batch.clear();
+    while (batch.size() < count && next())
+    {
+      batch.add_row(statement_);
+    }
+    return batch.size();
+  }
+
+  /// <summary>
+  /// stop early and let go of the statement and its read transaction, the destructor does this too
+  /// </summary>
+  void close()
+  {
+    if (statement_ != NULL)
+    {
+      sqlite3_finalize(statement_);
+      statement_ = NULL;
+    }
+  }
+
+  bool is_open() const { return statement_ != NULL; }
+  // true unless the sql was refused, did not compile or failed part way through
+  bool ok() const { return !failed_; }
+
+  // columns of the current row, empty for a NULL or missing column
+  std::string_view get(int column) const
+  {
+    const unsigned char* text = column < sqlite3_column_count(statement_) ? sqlite3_column_text(statement_, column) : NULL;
+    return text != NULL ? std::string_view(reinterpret_cast<const char*>(text), static_cast<size_t>(sqlite3_column_bytes(statement_, column))) : std::string_view();
+  }
+
+  std::string_view id() const { return get(0); }
+  std::string_view name() const { return get(1); }
+  std::string_view password() const { return get(2); }
+
+  /// <summary>
+  /// lets a cursor be used in a range for, each step hands back the cursor on its new row
+  /// </summary>
+  class iterator
+  {
+  public:
+    explicit iterator(query_cursor* cursor) : cursor_(cursor) {}
+
+    const query_cursor& operator*() const { return *cursor_; }
+
+    iterator& operator++()
+    {
+      if (!cursor_->next()) cursor_ = NULL;
+      return *this;
+    }
+
+    bool operator==(const iterator& other) const { return cursor_ == other.cursor_; }
+    bool operator!=(const iterator& other) const { return cursor_ != other.cursor_; }
+
+  private:
+    query_cursor* cursor_;
+  };
+
+  iterator begin() { return iterator(next() ? this : NULL); }
+  iterator end() { return iterator(NULL); }
+
+private:
+  bool prepare(const std::string& sql)
+  {
+    const char* tail = NULL;
+    if (sqlite3_prepare_v2(db_, sql.c_str(), static_cast<int>(sql.length()) + 1, &statement_, &tail) != SQLITE_OK || statement_ == NULL)
+    {
+      std::cout << "Data failed to be queried from USERS table. ERROR = " << sqlite3_errmsg(db_) << std::endl;
+      close();
+      failed_ = true;
+      return false;
+    }
+    for (; tail != NULL && *tail != '\0'; ++tail)
+    { // trailing semicolons and whitespace are fine, a second statement is not
+      if (*tail != ';' && *tail != ' ' && *tail != '\t' && *tail != '\n' && *tail != '\r')
+      {
+        std::cout << "Data failed to be queried from USERS table. ERROR = only one statement is allowed" << std::endl;
+        close();
+        failed_ = true;
+        return false;
+      }
+    }
+    return true;
+  }
+
+  sqlite3* db_;
+  sqlite3_stmt* statement_ = NULL;
+  bool failed_ = false;
+};
+
+// DO NOT CHANGE
+bool run_query_injection(sqlite3* db, const std::string& sql, std::vector< user_record >& records)
+{
+  std::string injectedSQL(sql);
+  std::string localCopy(sql);
+
+  // we work on the local copy because of the const
+  std::transform(localCopy.begin(), localCopy.end(), localCopy.begin(), ::tolower);
+  if(localCopy.find_last_of(str_where) >= 0)
+  { // this sql has a where clause
+    if(localCopy.back() == ';')
+    { // smart SQL developer terminated with a semicolon - we can fix that!
+      injectedSQL.pop_back();
+    }
+
+    switch (rand() % 4)
+    {
+    case 1:
+      injectedSQL.append(" or 2=2;");
+      break;
+    case 2:
+      injectedSQL.append(" or 'hi'='hi';");
+      break;
+    case 3:
+      injectedSQL.append(" or 'hack'='hack';");
+      break;
+    case 0:
+    default:
+      injectedSQL.append(" or 1=1;");
+      break;
+    }
+  }
+  
+  return run_query(db, injectedSQL, records);
+}
+
+
+// DO NOT CHANGE
+void dump_results(const std::string& sql, const std::vector< user_record >& records)
+{
+  std::cout << std::endl << "SQL: " << sql << " ==> " << records.size() << " records found." << std::endl;
+
+  for (auto record : records)
+  {
+    std::cout << "User: " << std::get<1>(record) << " [UID=" << std::get<0>(record) << " PWD=" << std::get<2>(record) << "]" << std::endl;
+  }
+}
+
+/// <summary>
+/// how result_writer lays out rows
+/// </summary>
+enum class result_format
+{
+  text,       // User: NAME [UID=ID PWD=PASSWORD], the same as dump_results
+  csv,        // ID,NAME,PASSWORD header then one quoted-as-needed row per line
+  json_lines  // one {"id":..,"name":..,"password":..} object per line
+};
+
+// bytes result_writer buffers before writing, big enough that a write is rarely more than a few syscalls a second
+const size_t result_writer_buffer_size = 1 << 20;
+
+/// <summary>
+/// formats rows into one reusable buffer and writes it out only when it fills or on flush(), instead
+/// of a stream insert and std::endl flush per line. writes to an ostream, or straight to a file
+/// descriptor with no stream in between
+/// </summary>
+class result_writer
+{
+public:
+  result_writer(std::ostream& output, result_format format = result_format::text, size_t buffer_size = result_writer_buffer_size)
+    : stream_(&output), format_(format), buffer_(buffer_size)
+  {
+  }
+
+  /// <summary>
+  /// write to an open file descriptor, which stays owned by the caller
+  /// </summary>
+  result_writer(int fd, result_format format = result_format::text, size_t buffer_size = result_writer_buffer_size)
+    : fd_(fd), format_(format), buffer_(buffer_size)
+  {
+  }
+
+  result_writer(const result_writer&) = delete;
+  result_writer& operator=(const result_writer&) = delete;
+
+  ~result_writer()
+  {
+    flush();
+  }
+
+  void write_row(std::string_view id, std::string_view name, std::string_view password)
+  {
+    switch (format_)
+    {
+    case result_format::text:
+      append("User: ");
+      append(name);
+      append(" [UID=");
+      append(id);
+      append(" PWD=");
+      append(password);
+      append("]\n");
+      break;
+
+    case result_format::csv:
+      if (rows_ == 0) append("ID,NAME,PASSWORD\n");
+      append_csv(id);
+      append(",");
+      append_csv(name);
+      append(",");
+      append_csv(password);
+      append("\n");
+      break;
+
+    case result_format::json_lines:
+      append("{\"id\":");
+      append_json(id);
+      append(",\"name\":");
+      append_json(name);
+      append(",\"password\":");
+      append_json(password);
+      append("}\n");
+      break;
+    }
+    ++rows_;
+  }
+
+  void write(const result_set& results)
+  {
+    for (size_t row = 0; row < results.size(); ++row)
+    {
+      write_row(results.id(row), results.name(row), results.password(row));
+    }
+  }
+
+  void write(const std::vector< user_record >& records)
+  {
+    for (const auto& record : records)
+    {
+      write_row(std::get<0>(record), std::get<1>(record), std::get<2>(record));
+    }
+  }
+
+  /// <summary>
+  /// write every remaining row of a cursor, memory stays at one buffer however many rows there are
+  /// </summary>
+  void write(query_cursor& cursor)
+  {
+    while (cursor.next())
+    {
+      write_row(cursor.id(), cursor.name(), cursor.password());
+    }
+  }
+
+  /// <summary>
+  /// add text outside of any row, e.g. a heading
+  /// </summary>
+  void write_text(std::string_view text)
+  {
+    append(text);
+  }
+
+  /// <summary>
+  /// write out whatever is buffered
+  /// </summary>
+  /// <returns>false if any write so far has failed</returns>
+  bool flush()
+  {
+    write_out(buffer_.data(), used_);
+    used_ = 0;
+    if (stream_ != NULL && !stream_->flush()) failed_ = true;
+    return !failed_;
+  }
+
+  size_t rows() const { return rows_; }
+  size_t bytes() const { return bytes_ + used_; }
+
+private:
+  void append(std::string_view text)
+  {
+    if (text.length() > buffer_.size() - used_)
+    {
+      write_out(buffer_.data(), used_);
+      used_ = 0;
+      if (text.length() > buffer_.size())
+      { // too big to buffer at all, write it straight through
+        write_out(text.data(), text.length());
+        return;
+      }
+    }
+    std::memcpy(buffer_.data() + used_, text.data(), text.length());
+    used_ += text.length();
+  }
+
+  void append_csv(std::string_view field)
+  {
+    if (field.find_first_of(",\"\r\n") == std::string_view::npos)
+    {
+      append(field);
+      return;
+    }
+    append("\"");
+    for (size_t quote; (quote = field.find('"')) != std::string_view::npos; field.remove_prefix(quote + 1))
+    {
+      append(field.substr(0, quote + 1));
+      append("\"");
+    }
+    append(field);
+    append("\"");
+  }
+
+  void append_json(std::string_view field)
+  {
+    static const char hex[] = "0123456789abcdef";
+    append("\"");
+    size_t start = 0;
+    for (size_t i = 0; i < field.length(); ++i)
+    {
+      const unsigned char c = static_cast<unsigned char>(field[i]);
+      if (c >= 0x20 && c != '"' && c != '\\') continue;
+
+      append(field.substr(start, i - start));
+      start = i + 1;
+      if (c == '"') append("\\\"");
+      else if (c == '\\') append("\\\\");
+      else if (c == '\n') append("\\n");
+      else if (c == '\r') append("\\r");
+      else if (c == '\t') append("\\t");
+      else
+      {
+        const char escaped[] = { '\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xf] };
+        append(std::string_view(escaped, sizeof(escaped)));
+      }
+    }
+    append(field.substr(start));
+    append("\"");
+  }
+
+  void write_out(const char* data, size_t length)
+  {
+    if (length == 0 || failed_) return;
+    bytes_ += length;
+
+    if (stream_ != NULL)
+    {
+      if (!stream_->write(data, static_cast<std::streamsize>(length))) failed_ = true;
+      return;
+    }
+
+    while (length > 0)
+    {
+#ifdef _WIN32
+      const int written = _write(fd_, data, static_cast<unsigned int>(std::min<size_t>(length, 1 << 30)));
+#else
+      const ssize_t written = ::write(fd_, data, length);
+      if (written < 0 && errno == EINTR) continue;
+#endif
+      if (written <= 0)
+      {
+        failed_ = true;
+        return;
+      }
+      data += written;
+      length -= static_cast<size_t>(written);
+    }
+  }
+
+  std::ostream* stream_ = NULL;
+  int fd_ = -1;
+  result_format format_;
+  std::vector<char> buffer_;
+  size_t used_ = 0;
+  size_t rows_ = 0;
+  size_t bytes_ = 0;
+  bool failed_ = false;
+};
+
+/// <summary>
+/// dump_results for a result set, reading straight out of the arena with no per row copies and
+/// writing them through a result_writer, one flush for the lot rather than one per row
+/// </summary>
+void dump_results(const std::string& sql, const result_set& results)
+{
+  std::cout << std::endl << "SQL: " << sql << " ==> " << results.size() << " records found." << std::endl;
+
+  result_writer writer(std::cout);
+  writer.write(results);
+}
+
+// DO NOT CHANGE
+void run_queries(sqlite3* db)
+{
+  char* error_message = NULL;
+
+  std::vector< user_record > records;
+
+  // query all
+  std::string sql = "SELECT * from USERS";
+  if (!run_query(db, sql, records)) return;
+  dump_results(sql, records);
+
+  //  query 1
+  sql = "SELECT ID, NAME, PASSWORD FROM USERS WHERE NAME='Fred'";
+  if (!run_query(db, sql, records)) return;
+  dump_results(sql, records);
+
+  //  run query 1 with injection 5 times
+  for (auto i = 0; i < 5; ++i)
+  {
+    if (!run_query_injection(db, sql, records)) continue;
+    dump_results(sql, records);
+  }
+
+}
+
+/// <summary>
+/// a fixed set of connections to one database. a file database is switched to WAL so readers on
+/// different connections run in parallel; ":memory:" becomes a named shared-cache in-memory database,
+/// which every connection sees, but sqlite serializes access to a shared cache internally
+/// </summary>
+class connection_pool
+{
+public:
+  /// <summary>
+  /// open size connections
+  /// </summary>
+  /// <param name="filename">database file, or ":memory:"</param>
+  /// <param name="size">number of connections</param>
+  connection_pool(const std::string& filename, size_t size)
+  {
+    static std::atomic<unsigned> memory_pools{ 0 };
+    const bool in_memory = filename == ":memory:";
+    const std::string uri = in_memory ? "file:connection_pool_" + std::to_string(memory_pools++) + "?mode=memory&cache=shared" : filename;
+    const int flags = SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_URI | SQLITE_OPEN_NOMUTEX;
+
+    for (size_t i = 0; i < std::max<size_t>(size, 1); ++i)
+    {
+      sqlite3* db = NULL;
+      if (sqlite3_open_v2(uri.c_str(), &db, flags, NULL) != SQLITE_OK)
+      {
+        std::cout << "Failed to connect to the database. ERROR=" << sqlite3_errmsg(db) << std::endl;
+        sqlite3_close(db);
+        break;
+      }
+      // readers wait for a writer instead of failing straight away
+      sqlite3_busy_timeout(db, 5000);
+      if (get_query_stats().enabled())
+      {
+        get_query_stats().attach(db);
+      }
+      if (i == 0 && !in_memory)
+      {
+        sqlite3_exec(db, "PRAGMA journal_mode=WAL;", NULL, NULL, NULL);
+      }
+      connections_.push_back(db);
+      idle_.push_back(db);
+    }
+  }
+
+  connection_pool(const connection_pool&) = delete;
+  connection_pool& operator=(const connection_pool&) = delete;
+
+  ~connection_pool()
+  {
+    for (sqlite3* db : connections_)
+    {
+      release_statement_cache(db);
+      sqlite3_close(db);
+    }
+  }
+
+  /// <summary>
+  /// take a connection, waiting for one to come back if they are all in use
+  /// </summary>
+  sqlite3* acquire()
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    returned_.wait(lock, [this]() { return !idle_.empty(); });
+    sqlite3* db = idle_.back();
+    idle_.pop_back();
+    return db;
+  }
+
+  void release(sqlite3* db)
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      idle_.push_back(db);
+    }
+    returned_.notify_one();
+  }
+
+  size_t size() const { return connections_.size(); }
+
+private:
+  std::vector<sqlite3*> connections_;
+  std::vector<sqlite3*> idle_;
+  std::mutex mutex_;
+  std::condition_variable returned_;
+};
+
+/// <summary>
+/// outcome of a query run by query_executor
+/// </summary>
+struct query_result
+{
+  bool ok = false;
+  std::vector< user_record > records;
+};
+
+/// <summary>
+/// runs run_query calls on worker threads, each worker holding one pooled connection for its lifetime
+/// (so each connection, and its statement cache, is only ever used by one thread)
+/// </summary>
+class query_executor
+{
+public:
+  /// <summary>
+  /// start one worker per pooled connection
+  /// </summary>
+  explicit query_executor(connection_pool& pool)
+  {
+    for (size_t i = 0; i < pool.size(); ++i)
+    {
+      workers_.emplace_back(&query_executor::run, this, std::ref(pool));
+    }
+  }
+
+  query_executor(const query_executor&) = delete;
+  query_executor& operator=(const query_executor&) = delete;
+
+  /// <summary>
+  /// finish queued queries, then stop the workers
+  /// </summary>
+  ~query_executor()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopping_ = true;
+    }
+    ready_.notify_all();
+    for (auto& worker : workers_)
+    {
+      worker.join();
+    }
+  }
+
+  /// <summary>
+  /// queue a query, screened and run exactly as run_query does
+  /// </summary>
+  /// <param name="sql">sql to run</param>
+  /// <returns>future for the query's result</returns>
+  std::future<query_result> submit(const std::string& sql)
+  {
+    return enqueue([sql](sqlite3* db)
+    {
+      query_result result;
+      result.ok = run_query(db, sql, result.records);
+      return result;
+    });
+  }
+
+  /// <summary>
+  /// queue a single statement with ? parameters bound as text
+  /// </summary>
+  std::future<query_result> submit(const std::string& sql, const std::vector<std::string>& parameters)
+  {
+    return enqueue([sql, parameters](sqlite3* db)
+    {
+      query_result result;
+      result.ok = run_query(db, sql, parameters, result.records);
+      return result;
+    });
+  }
+
+private:
+  typedef std::packaged_task<query_result(sqlite3*)> query_task;
+
+  std::future<query_result> enqueue(std::function<query_result(sqlite3*)> work)
+  {
+    query_task task(std::move(work));
+    std::future<query_result> result = task.get_future();
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      queue_.push_back(std::move(task));
+    }
+    ready_.notify_one();
+    return result;
+  }
+
+  void run(connection_pool& pool)
+  {
+    sqlite3* db = pool.acquire();
+    for (;;)
+    {
+      query_task task;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        ready_.wait(lock, [this]() { return stopping_ || !queue_.empty(); });
+        if (queue_.empty()) break;
+        task = std::move(queue_.front());
+        queue_.pop_front();
+      }
+      task(db);
+    }
+    pool.release(db);
+  }
+
+  std::vector<std::thread> workers_;
+  std::deque<query_task> queue_;
+  std::mutex mutex_;
+  std::condition_variable ready_;
+  bool stopping_ = false;
+};
+
+/// <summary>
+/// one statement shape from an index_advisor workload, its plan and the index proposed for it
+/// </summary>
+struct index_advice
+{
+  std::string shape;              // fingerprint_sql of the statement
+  std::string example;            // the first statement of this shape that was recorded
+  uint64_t calls = 0;
+  std::vector<std::string> plan;  // EXPLAIN QUERY PLAN detail lines
+  bool scans = false;             // the plan reads a whole table
+  std::string table;              // table and columns of the proposed index, in key order
+  std::vector<std::string> columns;
+  std::string create_index;       // CREATE INDEX that would avoid the scan, empty if none is proposed
+};
+
+/// <summary>
+/// records the statements a workload runs and, for each shape that makes sqlite scan a whole table,
+/// proposes an index: the columns compared with = or IS, then one range column, then the rest of the
+/// selected columns so the index covers the query and the table is never read. only single table
+/// SELECTs are analysed, and every name that goes into a CREATE INDEX comes from the schema itself
+/// </summary>
+class index_advisor
+{
+public:
+  explicit index_advisor(sqlite3* db)
+    : db_(db)
+  {
+  }
+
+  /// <summary>
+  /// count a statement in the workload, statements of one shape are counted together
+  /// </summary>
+  void record(const std::string& sql, uint64_t calls = 1)
+  {
+    std::string shape;
+    if (!fingerprint_sql(sql, shape)) return;
+    while (!shape.empty() && (shape.back() == ';' || shape.back() == ' ')) shape.pop_back();
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto found = workload_.find(shape);
+    if (found == workload_.end())
+    {
+      found = workload_.emplace(shape, workload_entry{ sql, 0 }).first;
+    }
+    found->second.calls += calls;
+  }
+
+  /// <summary>
+  /// explain every recorded shape, most called first
+  /// </summary>
+  std::vector<index_advice> advise() const
+  {
+    std::vector<index_advice> advice;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      for (const auto& entry : workload_)
+      {
+        index_advice item;
+        item.shape = entry.first;
+        item.example = entry.second.example;
+        item.calls = entry.second.calls;
+        advice.push_back(std::move(item));
+      }
+    }
+    std::sort(advice.begin(), advice.end(), [](const index_advice& left, const index_advice& right) { return left.calls > right.calls; });
+
+    for (auto& item : advice)
+    {
+      item.plan = explain(item.example);
+      item.scans = std::any_of(item.plan.begin(), item.plan.end(), [](const std::string& detail)
+      {
+        return detail.compare(0, 5, "SCAN ") == 0 && detail.compare(0, 14, "SCAN CONSTANT ") != 0;
+      });
+      if (item.scans && propose(item.example, item.table, item.columns)) item.create_index = create_index_sql(item.table, item.columns);
+    }
+
+    // an index whose columns start with all of another's serves both, propose only the longer one
+    for (auto& shorter : advice)
+    {
+      for (const auto& longer : advice)
+      {
+        if (&shorter != &longer && !shorter.columns.empty() && shorter.table == longer.table &&
+          longer.columns.size() > shorter.columns.size() && std::equal(shorter.columns.begin(), shorter.columns.end(), longer.columns.begin()))
+        {
+          shorter.columns = longer.columns;
+          shorter.create_index = longer.create_index;
+        }
+      }
+    }
+    return advice;
+  }
+
+  /// <summary>
+  /// create a proposed index
+  /// </summary>
+  /// <returns>true if it was created or already there</returns>
+  bool apply(const index_advice& advice)
+  {
+    if (advice.create_index.empty()) return false;
+
+    char* error_message = NULL;
+    if (sqlite3_exec(db_, advice.create_index.c_str(), NULL, NULL, &error_message) != SQLITE_OK)
+    {
+      std::cout << "Failed to create index. ERROR = " << error_message << std::endl;
+      sqlite3_free(error_message);
+      return false;
+    }
+    return true;
+  }
+
+  /// <summary>
+  /// EXPLAIN QUERY PLAN detail lines for a statement, empty if it does not compile
+  /// </summary>
+  std::vector<std::string> explain(const std::string& sql) const
+  {
+    std::vector<std::string> plan;
+    const std::string explain_sql = "EXPLAIN QUERY PLAN " + sql;
+    sqlite3_stmt* statement = NULL;
+    if (sqlite3_prepare_v2(db_, explain_sql.c_str(), -1, &statement, NULL) != SQLITE_OK)
+    {
+      return plan;
+    }
+    // columns are id, parent, notused, detail
+    while (sqlite3_step(statement) == SQLITE_ROW)
+    {
+      const unsigned char* detail = sqlite3_column_text(statement, 3);
+      plan.emplace_back(detail != NULL ? reinterpret_cast<const char*>(detail) : "");
+    }
+    sqlite3_finalize(statement);
+    return plan;
+  }
+
+private:
+  struct workload_entry
+  {
+    std::string example;
+    uint64_t calls;
+  };
+
+  /// <summary>
+  /// work out an index for a single table SELECT from its select list and WHERE clause
+  /// </summary>
+  /// <returns>false if there is nothing to propose</returns>
+  bool propose(const std::string& sql, std::string& table, std::vector<std::string>& key) const
+  {
+    sql_lexer lexer(sql);
+    sql_token token = lexer.next();
+    if (token.type != sql_token_type::word || !equals_ignore_case(token.text, "select")) return false;
+
+    // select list: plain column names can be covered, anything else (expressions, functions) cannot
+    std::vector<std::string> selected;
+    bool select_all = false;
+    bool coverable = true;
+    for (token = lexer.next(); token.type != sql_token_type::end && !(token.type == sql_token_type::word && equals_ignore_case(token.text, "from")); token = lexer.next())
+    {
+      if (token.type == sql_token_type::symbol && token.text == "*") select_all = true;
+      else if (token.type == sql_token_type::word || token.type == sql_token_type::quoted_identifier) selected.push_back(unquote(token.text));
+      else if (!(token.type == sql_token_type::symbol && token.text == ",")) coverable = false;
+    }
+
+    token = lexer.next();
+    if (token.type != sql_token_type::word && token.type != sql_token_type::quoted_identifier) return false;
+    table = schema_table(unquote(token.text));
+    if (table.empty()) return false;
+    const std::vector<std::string> columns = table_columns(table);
+
+    const auto is_keyword = [](const sql_token& word, std::initializer_list<const char*> keywords)
+    {
+      return word.type == sql_token_type::word &&
+        std::any_of(keywords.begin(), keywords.end(), [&](const char* keyword) { return equals_ignore_case(word.text, keyword); });
+    };
+    // skip an alias, give up on joins
+    token = lexer.next();
+    if (is_keyword(token, { "as" })) token = lexer.next();
+    if ((token.type == sql_token_type::word || token.type == sql_token_type::quoted_identifier) &&
+      !is_keyword(token, { "where", "order", "group", "limit", "join", "inner", "left", "right", "full", "cross", "natural" }))
+    {
+      token = lexer.next();
+    }
+    if ((token.type == sql_token_type::symbol && token.text == ",") || is_keyword(token, { "join", "inner", "left", "right", "full", "cross", "natural" }))
+    {
+      return false;
+    }
+
+    // WHERE: column = value and column IS value first, they fix a key prefix, then one range column
+    std::vector<std::string> equality;
+    std::string range;
+    if (is_keyword(token, { "where" }))
+    {
+      sql_token previous = { sql_token_type::end, std::string_view() };
+      for (token = lexer.next(); token.type != sql_token_type::end && token.type != sql_token_type::semicolon; token = lexer.next())
+      {
+        if (is_keyword(token, { "order", "group", "limit" })) break;
+        if (previous.type == sql_token_type::word || previous.type == sql_token_type::quoted_identifier)
+        {
+          const std::string column = schema_column(columns, unquote(previous.text));
+          const bool equals = (token.type == sql_token_type::comparison && (token.text == "=" || token.text == "==")) ||
+            (token.type == sql_token_type::word && equals_ignore_case(token.text, "is"));
+          const bool compares = token.type == sql_token_type::comparison && token.text != "!=" && token.text != "<>";
+          if (!column.empty() && equals)
+          {
+            if (std::find(equality.begin(), equality.end(), column) == equality.end()) equality.push_back(column);
+          }
+          else if (!column.empty() && compares && range.empty())
+          {
+            range = column;
+          }
+        }
+        previous = token;
+      }
+    }
+    if (equality.empty() && range.empty()) return false;
+
+    key = equality;
+    if (!range.empty() && std::find(key.begin(), key.end(), range) == key.end()) key.push_back(range);
+    if (coverable)
+    {
+      const std::vector<std::string> covered = select_all ? columns : [&]()
+      {
+        std::vector<std::string> names;
+        for (const auto& name : selected) names.push_back(schema_column(columns, name));
+        return names;
+      }();
+      for (const auto& column : covered)
+      {
+        if (!column.empty() && std::find(key.begin(), key.end(), column) == key.end()) key.push_back(column);
+      }
+    }
+    return true;
+  }
+
+  // a name in double quotes, with any " inside it doubled so it cannot close the quotes early
+  static std::string quote_identifier(std::string_view name)
+  {
+    std::string quoted = "\"";
+    for (const char c : name)
+    {
+      if (c == '"') quoted += '"';
+      quoted += c;
+    }
+    return quoted + "\"";
+  }
+
+  static std::string create_index_sql(const std::string& table, const std::vector<std::string>& key)
+  {
+    std::string name = "advisor_" + table;
+    std::string list;
+    for (const auto& column : key)
+    {
+      name += "_" + column;
+      list += (list.empty() ? "" : ", ") + quote_identifier(column);
+    }
+    std::transform(name.begin(), name.end(), name.begin(), [](char c) { return (c >= 'A' && c <= 'Z') ? static_cast<char>(c - 'A' + 'a') : c; });
+    return "CREATE INDEX IF NOT EXISTS " + quote_identifier(name) + " ON " + quote_identifier(table) + "(" + list + ");";
+  }
+
+  // the name inside its quotes, a doubled " or ` inside them is one character of the name
+  static std::string unquote(std::string_view name)
+  {
+    if (name.length() < 2 || (name.front() != '"' && name.front() != '`' && name.front() != '['))
+    {
+      return std::string(name);
+    }
+
+    const char close = name.front() == '[' ? ']' : name.front();
+    std::string unquoted;
+    for (size_t i = 1; i + 1 < name.length(); ++i)
+    {
+      unquoted += name[i];
+      if (name[i] == close && close != ']') ++i; // skip the second of the pair
+    }
+    return unquoted;
+  }
+
+  // the table's name as the schema spells it, empty if there is no such table
+  std::string schema_table(std::string_view name) const
+  {
+    std::string found;
+    sqlite3_stmt* statement = NULL;
+    if (sqlite3_prepare_v2(db_, "SELECT name FROM sqlite_master WHERE type='table' AND name=? COLLATE NOCASE", -1, &statement, NULL) == SQLITE_OK)
+    {
+      sqlite3_bind_text(statement, 1, name.data(), static_cast<int>(name.length()), SQLITE_TRANSIENT);
+      if (sqlite3_step(statement) == SQLITE_ROW)
+      {
+        found = reinterpret_cast<const char*>(sqlite3_column_text(statement, 0));
+      }
+    }
+    sqlite3_finalize(statement);
+    return found;
+  }
+
+  std::vector<std::string> table_columns(const std::string& table) const
+  {
+    std::vector<std::string> columns;
+    sqlite3_stmt* statement = NULL;
+    if (sqlite3_prepare_v2(db_, "SELECT name FROM pragma_table_info(?)", -1, &statement, NULL) == SQLITE_OK)
+    {
+      sqlite3_bind_text(statement, 1, table.c_str(), -1, SQLITE_TRANSIENT);
+      while (sqlite3_step(statement) == SQLITE_ROW)
+      {
+        columns.emplace_back(reinterpret_cast<const char*>(sqlite3_column_text(statement, 0)));
+      }
+    }
+    sqlite3_finalize(statement);
+    return columns;
+  }
+
+  // the column's name as the schema spells it, empty if the table has no such column
+  static std::string schema_column(const std::vector<std::string>& columns, std::string_view name)
+  {
+    for (const auto& column : columns)
+    {
+      if (equals_ignore_case(column, name)) return column;
+    }
+    return "";
+  }
+
+  sqlite3* db_;
+  mutable std::mutex mutex_;
+  std::unordered_map<std::string, workload_entry> workload_; // keyed by shape
+};
+
+/// <summary>
+/// copy every page of one connection's main database over another's with the online backup API
+/// </summary>
+/// <param name="from">connection to copy from</param>
+/// <param name="to">connection whose main database is replaced</param>
+/// <param name="pages">set to the number of pages copied</param>
+/// <returns>true if the copy completed</returns>
+static bool copy_database(sqlite3* from, sqlite3* to, int& pages)
+{
+  sqlite3_backup* backup = sqlite3_backup_init(to, "main", from, "main");
+  if (backup == NULL)
+  {
+    std::cout << "Failed to start the copy. ERROR = " << sqlite3_errmsg(to) << std::endl;
+    return false;
+  }
+  // all pages in one step, nothing else is using either connection
+  const int result = sqlite3_backup_step(backup, -1);
+  pages = sqlite3_backup_pagecount(backup);
+  sqlite3_backup_finish(backup);
+  if (result != SQLITE_DONE)
+  {
+    // an in-memory destination cannot change page size, a mismatch shows up here as SQLITE_READONLY
+    std::cout << "Failed to copy the database. ERROR = " << sqlite3_errstr(result) << std::endl;
+    return false;
+  }
+  return true;
+}
+
+/// <summary>
+/// copy the USERS data into a pool's database and run the same query from many threads at once, then
+/// again on a single connection to show how the readers scale. the pool uses a temporary WAL file, as
+/// a shared-cache in-memory database would serialize the connections
+/// </summary>
+/// <param name="db">populated source database</param>
+/// <param name="thread_count">connections / worker threads</param>
+/// <param name="query_count">queries to run</param>
+void run_queries_concurrently(sqlite3* db, size_t thread_count, size_t query_count)
+{
+  const std::filesystem::path file = std::filesystem::temp_directory_path() /
+    ("concurrent_" + std::to_string(std::chrono::steady_clock::now().time_since_epoch().count()) + ".db");
+
+  const std::string sql = "SELECT ID, NAME, PASSWORD FROM USERS WHERE NAME=?";
+  auto time_queries = [&](connection_pool& pool)
+  {
+    size_t rows = 0;
+    size_t failures = 0;
+    const auto start_time = std::chrono::steady_clock::now();
+    {
+      query_executor executor(pool);
+      std::vector< std::future<query_result> > results;
+      results.reserve(query_count);
+      for (size_t i = 0; i < query_count; ++i)
+      {
+        results.push_back(executor.submit(sql, { "Fred" }));
+      }
+      for (auto& result : results)
+      {
+        const query_result done = result.get();
+        rows += done.records.size();
+        failures += done.ok ? 0 : 1;
+      }
+    }
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start_time;
+
+    std::cout << std::endl << "Concurrent: " << query_count << " queries on " << pool.size() << " connections, "
+      << rows << " rows, " << failures << " failed in " << elapsed.count() << "s ("
+      << (elapsed.count() > 0 ? static_cast<double>(query_count) / elapsed.count() : 0.0) << " queries/s)." << std::endl;
+  };
+
+  {
+    connection_pool pool(file.string(), thread_count);
+    if (pool.size() == 0) return;
+
+    // seed the pool's database from ours, every pooled connection sees the copy
+    sqlite3* seed = pool.acquire();
+    int pages = 0;
+    const bool seeded = copy_database(db, seed, pages);
+    pool.release(seed);
+
+    if (seeded)
+    {
+      time_queries(pool);
+      if (pool.size() > 1)
+      {
+        connection_pool single(file.string(), 1);
+        if (single.size() == 1) time_queries(single);
+      }
+    }
+  }
+
+  std::error_code error;
+  for (const char* suffix : { "", "-wal", "-shm" })
+  {
+    std::filesystem::remove(file.string() + suffix, error);
+  }
+}
+
+/// <summary>
+/// replace the database with a snapshot file written by save_snapshot, page for page, so a restart
+/// costs one sequential read of the file instead of reloading and reindexing every row
+/// </summary>
+/// <param name="db">connection to load into, usually ":memory:"</param>
+/// <param name="filename">snapshot file</param>
+/// <returns>true if the snapshot loaded</returns>
+bool load_snapshot(sqlite3* db, const std::string& filename)
+{
+  const auto start_time = std::chrono::steady_clock::now();
+  sqlite3* snapshot = NULL;
+  if (sqlite3_open_v2(filename.c_str(), &snapshot, SQLITE_OPEN_READONLY, NULL) != SQLITE_OK)
+  {
+    std::cout << "Could not open the snapshot - '" << filename << "'. ERROR = " << sqlite3_errmsg(snapshot) << std::endl;
+    sqlite3_close(snapshot);
+    return false;
+  }
+
+  int pages = 0;
+  const bool ok = copy_database(snapshot, db, pages);
+  sqlite3_close(snapshot);
+  const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start_time;
+
+  if (ok)
+  {
+    std::cout << "Loaded snapshot " << filename << " (" << pages << " pages) in " << elapsed.count() << "s." << std::endl;
+  }
+  return ok;
+}
+
+/// <summary>
+/// write the database to a snapshot file for load_snapshot. the copy goes to a temporary file that
+/// replaces the old snapshot only once it is complete, so a failed save never leaves a torn snapshot
+/// </summary>
+/// <param name="db">connection to save</param>
+/// <param name="filename">snapshot file, replaced if it exists</param>
+/// <returns>true if the snapshot was written</returns>
+bool save_snapshot(sqlite3* db, const std::string& filename)
+{
+  const auto start_time = std::chrono::steady_clock::now();
+  const std::string temporary = filename + ".tmp";
+  std::remove(temporary.c_str());
+
+  sqlite3* snapshot = NULL;
+  if (sqlite3_open_v2(temporary.c_str(), &snapshot, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, NULL) != SQLITE_OK)
+  {
+    std::cout << "Could not create the snapshot - '" << temporary << "'. ERROR = " << sqlite3_errmsg(snapshot) << std::endl;
+    sqlite3_close(snapshot);
+    return false;
+  }
+  // nothing reads the file until it is renamed into place, so it needs no journal. synchronous stays
+  // FULL so the copy is on disk before it replaces the old snapshot
+  sqlite3_exec(snapshot, "PRAGMA journal_mode=OFF;", NULL, NULL, NULL);
+
+  int pages = 0;
+  const bool ok = copy_database(db, snapshot, pages);
+  sqlite3_close(snapshot);
+
+  std::error_code error;
+  if (ok)
+  {
+    std::filesystem::rename(temporary, filename, error);
+  }
+  if (!ok || error)
+  {
+    std::cout << "Failed to save the snapshot - '" << filename << "'" << (error ? ". ERROR = " + error.message() : "") << std::endl;
+    std::remove(temporary.c_str());
+    return false;
+  }
+
+  const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start_time;
+  std::cout << std::endl << "Saved snapshot " << filename << " (" << pages << " pages) in " << elapsed.count() << "s." << std::endl;
+  return true;
+}
+
+/// <summary>
+/// bulk load a CSV file of users and report how fast it went
+/// </summary>
+/// <returns>true if the file loaded</returns>
+bool load_users_file(sqlite3* db, const std::string& filename)
+{
+  std::ifstream input(filename);
+  if (!input.is_open())
+  {
+    std::cout << "Could not open the file - '" << filename << "'" << std::endl;
+    return false;
+  }
+
+  size_t rows = 0;
+  const auto start_time = std::chrono::steady_clock::now();
+  const bool ok = bulk_load_users(db, input, bulk_load_options(), rows);
+  const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start_time;
+
+  if (ok)
+  {
+    std::cout << "Bulk loaded " << rows << " users in " << elapsed.count() << "s ("
+      << (elapsed.count() > 0 ? static_cast<double>(rows) / elapsed.count() : 0.0) << " rows/s)." << std::endl;
+  }
+  return ok;
+}
+
+/// <summary>
+/// time screen_sql, with and without the verdict cache, against the lowercase copy and find(" or ")
+/// check it replaced, over a mix of clean and injected statements. every statement is checked
+/// against the verdict it should get first, straight and through the cache both before and after its
+/// shape is cached, and any the screen gets wrong are listed
+/// </summary>
+/// <param name="iterations">passes over the statement mix</param>
+void run_screen_benchmark(size_t iterations)
+{
+  // statement, whether it should be flagged
+  const std::vector< std::pair<std::string, bool> > checks = {
+    { "SELECT ID, NAME, PASSWORD FROM USERS", false },
+    { "SELECT ID, NAME, PASSWORD FROM USERS WHERE NAME='Fred'", false },
+    { "SELECT ID, NAME, PASSWORD FROM USERS WHERE NAME='Fred' OR NAME='Barney' ORDER BY ID", false },
+    { "SELECT ID, NAME, PASSWORD FROM USERS WHERE NAME='Gregory or Greg' AND PASSWORD LIKE 'w%'", false },
+    { "SELECT /* padding comment */ ID, NAME, PASSWORD FROM USERS WHERE NAME='Fred' AND ID > 3", false },
+    { "SELECT ID, NAME, PASSWORD FROM USERS WHERE NAME='Fred' OR 0", false },
+    { "SELECT ID, NAME, PASSWORD FROM USERS WHERE NAME='Fred' or 1=1;", true },
+    { "SELECT ID, NAME, PASSWORD FROM USERS WHERE NAME='Fred' or 'hack'='hack';", true },
+    { "SELECT ID, NAME, PASSWORD FROM USERS WHERE NAME='Fred'; DROP TABLE USERS;", true },
+    { "SELECT ID, NAME, PASSWORD FROM USERS WHERE NAME='Fred' /* padding comment */ AND ID > 3", true },
+    { "SELECT ID, NAME, PASSWORD FROM USERS WHERE NAME='Fred' OR NOT 0", true },
+    { "SELECT ID, NAME, PASSWORD FROM USERS WHERE NAME='Fred' OR '1'", true },
+    { "SELECT ID, NAME, PASSWORD FROM USERS WHERE NAME='Fred' OR 0+1=1", true },
+    { "SELECT ID, NAME, PASSWORD FROM USERS WHERE NAME='Fred' OR 'a'||'b'='ab'", true },
+    { "SELECT ID, NAME, PASSWORD FROM USERS WHERE NAME='Fred' OR abs(1)=1", true },
+    { "SELECT ID, NAME, PASSWORD FROM USERS WHERE NAME='Fred' OR NAME<>''", true },
+    { "SELECT ID, NAME, PASSWORD FROM USERS WHERE NAME='Fred' OR ID > 0", true },
+    { "SELECT ID, NAME, PASSWORD FROM USERS WHERE NAME='Fred' UNION SELECT ID, NAME, PASSWORD FROM USERS", true },
+    { "SELECT ID, NAME, PASSWORD FROM USERS WHERE NAME='Fred'--' AND PASSWORD='Flinstone'", true },
+  };
+
+  std::vector<std::string> statements;
+  get_injection_verdict_cache().clear();
+  for (const auto& check : checks)
+  {
+    if ((screen_sql(check.first) != injection_verdict::clean) != check.second)
+    {
+      std::cout << "Screen check failed, expected " << (check.second ? "flagged" : "clean") << ": " << check.first << std::endl;
+    }
+    statements.push_back(check.first);
+  }
+  for (int pass = 0; pass < 2; ++pass)
+  { // the first pass caches each shape, the second reads it back, a shape shared by a clean statement must not hide an injected one
+    for (const auto& check : checks)
+    {
+      if ((screen_sql_cached(check.first) != injection_verdict::clean) != check.second)
+      {
+        std::cout << "Cached screen check failed, expected " << (check.second ? "flagged" : "clean") << ": " << check.first << std::endl;
+      }
+    }
+  }
+
+  size_t flagged = 0;
+  auto start_time = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < iterations; ++i)
+  {
+    for (const auto& sql : statements)
+    {
+      flagged += screen_sql(sql) != injection_verdict::clean ? 1 : 0;
+    }
+  }
+  const std::chrono::duration<double> screen_elapsed = std::chrono::steady_clock::now() - start_time;
+
+  size_t cached_flagged = 0;
+  get_injection_verdict_cache().clear();
+  start_time = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < iterations; ++i)
+  {
+    for (const auto& sql : statements)
+    {
+      cached_flagged += screen_sql_cached(sql) != injection_verdict::clean ? 1 : 0;
+    }
+  }
+  const std::chrono::duration<double> cached_elapsed = std::chrono::steady_clock::now() - start_time;
+
+  size_t found = 0;
+  start_time = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < iterations; ++i)
+  {
+    for (const auto& sql : statements)
+    {
+      std::string localCopy(sql);
+      std::transform(localCopy.begin(), localCopy.end(), localCopy.begin(), ::tolower);
+      found += localCopy.find(" or ") != std::string::npos ? 1 : 0;
+    }
+  }
+  const std::chrono::duration<double> find_elapsed = std::chrono::steady_clock::now() - start_time;
+
+  const double count = static_cast<double>(iterations * statements.size());
+  std::cout << std::endl << "Screen: " << count << " statements, " << flagged << " flagged in " << screen_elapsed.count() << "s ("
+    << (screen_elapsed.count() > 0 ? count / screen_elapsed.count() : 0.0) << " statements/s)." << std::endl;
+  std::cout << "Screen by shape: " << count << " statements, " << cached_flagged << " flagged in " << cached_elapsed.count() << "s ("
+    << (cached_elapsed.count() > 0 ? count / cached_elapsed.count() : 0.0) << " statements/s, "
+    << get_injection_verdict_cache().hits() << " cache hits)." << std::endl;
+  std::cout << "Lowercase copy and find: " << count << " statements, " << found << " flagged in " << find_elapsed.count() << "s ("
+    << (find_elapsed.count() > 0 ? count / find_elapsed.count() : 0.0) << " statements/s)." << std::endl;
+}
+
+/// <summary>
+/// read every USERS row through a cursor in batches, memory use is one batch whatever the table size
+/// </summary>
+/// <param name="db">connection to scan</param>
+/// <param name="batch_size">rows per fetch</param>
+void run_cursor_scan(sqlite3* db, size_t batch_size)
+{
+  size_t rows = 0;
+  size_t bytes = 0;
+  const auto start_time = std::chrono::steady_clock::now();
+
+  query_cursor cursor(db, "SELECT ID, NAME, PASSWORD FROM USERS");
+  result_set batch;
+  batch.reserve(batch_size);
+  while (cursor.fetch(batch, batch_size) > 0)
+  {
+    for (size_t row = 0; row < batch.size(); ++row)
+    {
+      bytes += batch.id(row).length() + batch.name(row).length() + batch.password(row).length();
+    }
+    rows += batch.size();
+  }
+  const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start_time;
+
+  std::cout << std::endl << "Cursor scan: " << rows << " rows, " << bytes << " bytes in batches of " << batch_size << " in "
+    << elapsed.count() << "s (" << (elapsed.count() > 0 ? static_cast<double>(rows) / elapsed.count() : 0.0) << " rows/s)"
+    << (cursor.ok() ? "." : ", failed.") << std::endl;
+}
+
+/// <summary>
+/// write all of USERS to a file through a cursor and a result_writer, as CSV for a .csv name, JSON
+/// Lines for .jsonl and the dump_results text layout otherwise
+/// </summary>
+/// <returns>true if every row was written</returns>
+bool export_users(sqlite3* db, const std::string& filename)
+{
+  const auto ends_with = [&](const char* suffix)
+  {
+    const size_t length = std::char_traits<char>::length(suffix);
+    return filename.length() >= length && filename.compare(filename.length() - length, length, suffix) == 0;
+  };
+  const result_format format = ends_with(".csv") ? result_format::csv : ends_with(".jsonl") ? result_format::json_lines : result_format::text;
+
+#ifdef _WIN32
+  const int fd = _open(filename.c_str(), _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+  const int fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+#endif
+  if (fd < 0)
+  {
+    std::cout << "Could not open the file - '" << filename << "'" << std::endl;
+    return false;
+  }
+
+  const auto start_time = std::chrono::steady_clock::now();
+  query_cursor cursor(db, "SELECT ID, NAME, PASSWORD FROM USERS");
+  result_writer writer(fd, format);
+  writer.write(cursor);
+  const bool ok = writer.flush() && cursor.ok();
+  const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start_time;
+#ifdef _WIN32
+  _close(fd);
+#else
+  ::close(fd);
+#endif
+
+  std::cout << std::endl << "Exported " << writer.rows() << " rows, " << writer.bytes() << " bytes to " << filename << " in "
+    << elapsed.count() << "s (" << (elapsed.count() > 0 ? static_cast<double>(writer.rows()) / elapsed.count() : 0.0) << " rows/s)"
+    << (ok ? "." : ", failed.") << std::endl;
+  return ok;
+}
+
+/// <summary>
+/// build a USERS table of rows synthetic users, run a small workload over it, then let index_advisor
+/// propose indexes, create them and run the workload again
+/// </summary>
+/// <param name="rows">synthetic users to generate</param>
+/// <returns>true if the table was built and the workload ran</returns>
+bool run_index_advisor(size_t rows)
+{
+  sqlite3* db = NULL;
+  if (sqlite3_open(":memory:", &db) != SQLITE_OK || !initialize_database(db))
+  {
+    std::cout << "Failed to build the advisor database." << std::endl;
+    sqlite3_close(db);
+    return false;
+  }
+
+  // 50000 distinct names, so an equality lookup matches rows / 50000 users
+  auto start_time = std::chrono::steady_clock::now();
+  bool loaded = false;
+  {
+    users_bulk_loader loader(db);
+    loaded = loader.begin(bulk_load_options());
+    std::string name;
+    std::string password;
+    for (size_t i = 0; loaded && i < rows; ++i)
+    {
+      name = "user" + std::to_string(i % 50000);
+      password = "pw" + std::to_string(i % 1000);
+      loaded = loader.add(static_cast<sqlite3_int64>(i + 5), name, password);
+    }
+    loaded = loaded && loader.commit();
+  }
+  if (!loaded)
+  {
+    // the loader has already reported why
+    release_statement_cache(db);
+    sqlite3_close(db);
+    return false;
+  }
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start_time;
+  std::cout << std::endl << "Advisor: generated " << rows << " users in " << elapsed.count() << "s." << std::endl;
+
+  struct workload_query
+  {
+    std::string sql;
+    std::vector<std::string> parameters;
+  };
+  const std::vector<workload_query> workload = {
+    { "SELECT ID, NAME, PASSWORD FROM USERS WHERE NAME='Fred'", {} },
+    { "SELECT ID, NAME, PASSWORD FROM USERS WHERE NAME=?", { "user42" } },
+    { "SELECT ID FROM USERS WHERE PASSWORD='pw7' AND NAME='user7'", {} },
+    { "SELECT NAME FROM USERS WHERE PASSWORD > 'pw990'", {} },
+    { "SELECT * FROM USERS WHERE ID=3", {} },
+  };
+
+  // median of a few runs of each query, in milliseconds
+  result_set results;
+  const auto time_workload = [&]()
+  {
+    std::vector<double> latencies;
+    for (const auto& query : workload)
+    {
+      std::vector<double> runs;
+      for (int run = 0; run < 5; ++run)
+      {
+        const auto query_start = std::chrono::steady_clock::now();
+        if (query.parameters.empty()) run_query(db, query.sql, results);
+        else run_query(db, query.sql, query.parameters, results);
+        runs.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - query_start).count());
+      }
+      std::sort(runs.begin(), runs.end());
+      latencies.push_back(runs[runs.size() / 2]);
+    }
+    return latencies;
+  };
+
+  index_advisor advisor(db);
+  for (const auto& query : workload)
+  {
+    advisor.record(query.sql, 5);
+  }
+  const std::vector<double> before = time_workload();
+
+  const std::vector<index_advice> advice = advisor.advise();
+  start_time = std::chrono::steady_clock::now();
+  for (const auto& item : advice)
+  {
+    std::cout << std::endl << item.shape << std::endl << "  calls=" << item.calls << (item.scans ? " scans the table" : "") << std::endl;
+    for (const auto& detail : item.plan)
+    {
+      std::cout << "  plan: " << detail << std::endl;
+    }
+    if (!item.create_index.empty())
+    {
+      std::cout << "  advice: " << item.create_index << std::endl;
+      advisor.apply(item);
+    }
+  }
+  elapsed = std::chrono::steady_clock::now() - start_time;
+  std::cout << std::endl << "Advisor: created the indexes in " << elapsed.count() << "s." << std::endl;
+
+  const std::vector<double> after = time_workload();
+  for (size_t i = 0; i < workload.size(); ++i)
+  {
+    const std::vector<std::string> plan = advisor.explain(workload[i].sql);
+    std::cout << workload[i].sql << std::endl << "  before " << before[i] << "ms, after " << after[i] << "ms"
+      << (plan.empty() ? "" : ", plan: " + plan.front()) << std::endl;
+  }
+
+  release_statement_cache(db);
+  sqlite3_close(db);
+  return true;
+}
+
+/// <summary>
+/// read a whole command line argument as a count. std::stoul throws on a typo and takes -1 as a huge
+/// number, this just says no
+/// </summary>
+/// <param name="text">argument text</param>
+/// <param name="value">set to the count</param>
+/// <returns>true if the argument is a count and nothing else</returns>
+static bool parse_count(const char* text, size_t& value)
+{
+  const char* end = text + std::strlen(text);
+  const auto parsed = std::from_chars(text, end, value);
+  return parsed.ec == std::errc() && parsed.ptr == end;
+}
+
+// an argument main has already checked with parse_count
+static size_t count_argument(const char* text)
+{
+  size_t value = 0;
+  parse_count(text, value);
+  return value;
+}
+
+// You can change main by adding stuff to it, but all of the existing code must remain, and be in the
+// in the order called, and with none of this existing code placed into conditional statements
+//  optional arguments:
+//   --snapshot <file>   replace the database with a snapshot before the queries run
+//   --load <csv file>   bulk load ID,NAME,PASSWORD rows into USERS before the queries run
+//   --concurrent <n>    afterwards, run the NAME lookup 10000 times across n pooled connections
+//   --screen-benchmark <n>  afterwards, time the injection screen over n passes of a statement mix
+//   --scan <n>          afterwards, read all of USERS through a cursor n rows at a time
+//   --export <file>     afterwards, write all of USERS to file as .csv, .jsonl or text
+//   --advise <rows>     afterwards, try the index advisor on a separate table of that many synthetic users
+//   --save-snapshot <file>  afterwards, write the database to a snapshot file for --snapshot
+//   --stats <seconds>   time every statement by phase, report every so many seconds (0 for only at the end)
+int main(int argc, char* argv[])
+{
+  // initialize random seed:
+  srand(time(nullptr));
+
+  int return_code = 0;
+  std::cout << "SQL Injection Example" << std::endl;
+
+  // check the numeric options before anything runs, a typo stops here with the usage
+  static const char* const count_options[] = { "--stats", "--concurrent", "--screen-benchmark", "--scan", "--advise" };
+  for (int i = 1; i < argc; ++i)
+  {
+    size_t count = 0;
+    if (std::any_of(std::begin(count_options), std::end(count_options), [&](const char* option) { return std::strcmp(argv[i], option) == 0; }) &&
+      (i + 1 >= argc || !parse_count(argv[i + 1], count)))
+    {
+      std::cout << "Expected a count after " << argv[i] << ". Usage: " << argv[0]
+        << " [--snapshot <file>] [--load <csv file>] [--concurrent <n>] [--screen-benchmark <n>] [--scan <n>]"
+        << " [--export <file>] [--advise <rows>] [--save-snapshot <file>] [--stats <seconds>]" << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+  std::unique_ptr<query_stats_reporter> stats_reporter;
+
+  // the database handle
+  sqlite3* db = NULL;
+  char* error_message = NULL;
+
+  // open the database connection
+  int result = sqlite3_open(":memory:", &db);
+
+  if(result != SQLITE_OK)
+  {
+    std::cout << "Failed to connect to the database and terminating. ERROR=" << sqlite3_errmsg(db) << std::endl;
+    return -1;
+  }
+
+  std::cout << "Connected to the database." << std::endl;
+
+  // initialize our database
+  if(!initialize_database(db))
+  {
+    std::cout << "Database Initialization Failed. Terminating." << std::endl;
+    return_code = -1;
+  }
+  else
+  {
+    for (int i = 1; i + 1 < argc; ++i)
+    {
+      if (std::string(argv[i]) == "--stats")
+      {
+        get_query_stats().enable(true);
+        get_query_stats().attach(db);
+        const size_t seconds = count_argument(argv[i + 1]);
+        if (seconds > 0)
+        {
+          stats_reporter.reset(new query_stats_reporter(std::cout, std::chrono::seconds(seconds)));
+        }
+      }
+    }
+
+    for (int i = 1; i + 1 < argc; ++i)
+    {
+      if (std::string(argv[i]) == "--snapshot" && !load_snapshot(db, argv[i + 1]))
+      {
+        return_code = -1;
+      }
+      else if (std::string(argv[i]) == "--load" && !load_users_file(db, argv[i + 1]))
+      {
+        return_code = -1;
+      }
+    }
+
+    run_queries(db);
+
+    for (int i = 1; i + 1 < argc; ++i)
+    {
+      if (std::string(argv[i]) == "--concurrent")
+      {
+        run_queries_concurrently(db, count_argument(argv[i + 1]), 10000);
+      }
+      else if (std::string(argv[i]) == "--screen-benchmark")
+      {
+        run_screen_benchmark(count_argument(argv[i + 1]));
+      }
+      else if (std::string(argv[i]) == "--scan")
+      {
+        run_cursor_scan(db, count_argument(argv[i + 1]));
+      }
+      else if (std::string(argv[i]) == "--export" && !export_users(db, argv[i + 1]))
+      {
+        return_code = -1;
+      }
+      else if (std::string(argv[i]) == "--advise" && !run_index_advisor(count_argument(argv[i + 1])))
+      {
+        return_code = -1;
+      }
+      else if (std::string(argv[i]) == "--save-snapshot" && !save_snapshot(db, argv[i + 1]))
+      {
+        return_code = -1;
+      }
+    }
+  }
+
+  stats_reporter.reset();
+  if (get_query_stats().enabled())
+  {
+    get_query_stats().dump(std::cout);
+  }
+
+  // cached statements have to be finalized before the connection will close
+  release_statement_cache(db);
+
   // close the connection if opened
   if(db != NULL)
   {
@@ -1,106 +1,2217 @@
 // Encryption.cpp : This file contains the 'main' function. Program execution begins and ends there.
 //
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <filesystem>
 #include <fstream>
+#include <functional>
 #include <iomanip>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <span>
 #include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
 #include <ctime>
 
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define XOR_KERNEL_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// MSVC lets any intrinsic be used in any function, gcc / clang need the target enabled per function
+#if defined(__GNUC__) || defined(__clang__)
+#define XOR_TARGET(isa) __attribute__((target(isa)))
+#else
+#define XOR_TARGET(isa)
+#endif
+
+// the widest vector any kernel loads from the expanded key pattern in one go
+constexpr size_t xor_max_vector_width = 64;
+
+/// <summary>
+/// repeat the key so that a full vector can be loaded from any key phase without wrapping
+/// </summary>
+/// <param name="key">key to expand</param>
+/// <returns>key repeated out to at least key length + the widest vector</returns>
+std::string expand_key(const std::string& key)
+{
+	const auto key_length = key.length();
+	assert(key_length > 0);
+
+	std::string pattern;
+	pattern.reserve(key_length + xor_max_vector_width + key_length);
+	while (pattern.length() < key_length + xor_max_vector_width)
+	{
+		pattern += key;
+	}
+
+	return pattern;
+}
+
+/// <summary>
+/// expanded pattern for a key, kept per thread so callers that reuse the same key do not pay for
+/// (or allocate) the expansion on every call
+/// </summary>
+/// <param name="key">key to expand</param>
+/// <returns>expand_key(key), valid until this thread asks for a different key</returns>
+const std::string& cached_key_pattern(const std::string& key)
+{
+	thread_local std::string cached_key;
+	thread_local std::string cached_pattern;
+
+	if (cached_pattern.empty() || key != cached_key)
+	{
+		cached_key = key;
+		cached_pattern = expand_key(key);
+	}
+
+	return cached_pattern;
+}
+
+/// <summary>
+/// signature shared by the vector kernels. each kernel processes whole vectors only, advances
+/// phase (the key index of the next byte) and returns how many bytes it consumed
+/// </summary>
+typedef size_t(*xor_kernel)(const char* source, char* output, size_t length, const char* pattern, size_t key_length, size_t& phase);
+
+static size_t xor_kernel_none(const char*, char*, size_t, const char*, size_t, size_t&)
+{
+	return 0;
+}
+
+#ifdef XOR_KERNEL_X86
+static size_t xor_kernel_sse2(const char* source, char* output, size_t length, const char* pattern, size_t key_length, size_t& phase)
+{
+	const size_t step = 16 % key_length;
+	size_t i = 0;
+	for (; i + 16 <= length; i += 16)
+	{
+		const __m128i data = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i));
+		const __m128i mask = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pattern + phase));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(output + i), _mm_xor_si128(data, mask));
+		phase += step;
+		if (phase >= key_length) phase -= key_length;
+	}
+	return i;
+}
+
+XOR_TARGET("avx2")
+static size_t xor_kernel_avx2(const char* source, char* output, size_t length, const char* pattern, size_t key_length, size_t& phase)
+{
+	const size_t step = 32 % key_length;
+	size_t i = 0;
+	for (; i + 32 <= length; i += 32)
+	{
+		const __m256i data = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(source + i));
+		const __m256i mask = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pattern + phase));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(output + i), _mm256_xor_si256(data, mask));
+		phase += step;
+		if (phase >= key_length) phase -= key_length;
+	}
+	return i;
+}
+
+XOR_TARGET("avx512f")
+static size_t xor_kernel_avx512(const char* source, char* output, size_t length, const char* pattern, size_t key_length, size_t& phase)
+{
+	const size_t step = 64 % key_length;
+	size_t i = 0;
+	for (; i + 64 <= length; i += 64)
+	{
+		const __m512i data = _mm512_loadu_si512(source + i);
+		const __m512i mask = _mm512_loadu_si512(pattern + phase);
+		_mm512_storeu_si512(output + i, _mm512_xor_si512(data, mask));
+		phase += step;
+		if (phase >= key_length) phase -= key_length;
+	}
+	return i;
+}
+
+/// <summary>
+/// ask the cpu (and the os, for the wider register state) which vector kernels we can use
+/// </summary>
+/// <returns>the widest kernel supported on this machine</returns>
+static xor_kernel detect_xor_kernel()
+{
+#ifdef _MSC_VER
+	int info[4] = { 0 };
+	__cpuid(info, 0);
+	const int max_leaf = info[0];
+
+	__cpuid(info, 1);
+	const bool has_sse2 = (info[3] & (1 << 26)) != 0;
+	const bool has_osxsave = (info[2] & (1 << 27)) != 0;
+	const unsigned long long xcr0 = has_osxsave ? _xgetbv(0) : 0;
+
+	bool has_avx2 = false;
+	bool has_avx512 = false;
+	if (max_leaf >= 7)
+	{
+		__cpuidex(info, 7, 0);
+		has_avx2 = (info[1] & (1 << 5)) != 0 && (xcr0 & 0x6) == 0x6;
+		has_avx512 = (info[1] & (1 << 16)) != 0 && (xcr0 & 0xE6) == 0xE6;
+	}
+#else
+	__builtin_cpu_init();
+	const bool has_sse2 = __builtin_cpu_supports("sse2");
+	const bool has_avx2 = __builtin_cpu_supports("avx2");
+	const bool has_avx512 = __builtin_cpu_supports("avx512f");
+#endif
+
+	if (has_avx512) return xor_kernel_avx512;
+	if (has_avx2) return xor_kernel_avx2;
+	if (has_sse2) return xor_kernel_sse2;
+	return xor_kernel_none;
+}
+#else
+static xor_kernel detect_xor_kernel()
+{
+	return xor_kernel_none;
+}
+#endif
+
+/// <summary>
+/// xor a buffer against a repeating key with a specific kernel, see xor_buffer
+/// </summary>
+void xor_buffer_with(xor_kernel kernel, const char* source, char* output, size_t length, const std::string& pattern, size_t key_length, size_t key_offset)
+{
+	assert(key_length > 0);
+	assert(pattern.length() >= key_length + xor_max_vector_width);
+
+	size_t phase = key_offset % key_length;
+	const size_t done = kernel(source, output, length, pattern.data(), key_length, phase);
+
+	// scalar tail, keep walking the phase instead of taking a modulo per byte
+	for (size_t i = done; i < length; ++i)
+	{
+		output[i] = source[i] ^ pattern[phase];
+		if (++phase == key_length) phase = 0;
+	}
+}
+
+/// <summary>
+/// xor a buffer against a repeating key starting at an arbitrary position in the key stream
+/// </summary>
+/// <param name="source">bytes to transform</param>
+/// <param name="output">destination, may be the same as source</param>
+/// <param name="length">number of bytes to transform</param>
+/// <param name="pattern">key expanded with expand_key()</param>
+/// <param name="key_length">length of the original key</param>
+/// <param name="key_offset">stream position of source[0], i.e. source[0] is xor'ed with key[key_offset % key_length]</param>
+void xor_buffer(const char* source, char* output, size_t length, const std::string& pattern, size_t key_length, size_t key_offset)
+{
+	// pick the kernel once, the cpu is not going to change under us
+	static const xor_kernel kernel = detect_xor_kernel();
+
+	xor_buffer_with(kernel, source, output, length, pattern, key_length, key_offset);
+}
+
+/// <summary>
+/// encrypt or decrypt a source string using the provided key
+/// </summary>
+/// <param name="source">input string to process</param>
+/// <param name="key">key to use in encryption / decryption</param>
+/// <returns>transformed string</returns>
+std::string encrypt_decrypt(const std::string& source, const std::string& key)
+{
+	// get lengths now instead of calling the function every time.
+	// this would have most likely been inlined by the compiler, but design for perfomance.
+	const auto key_length = key.length();
+	const auto source_length = source.length();
+
+	// assert that our input data is good
+	assert(key_length > 0);
+	assert(source_length > 0);
+
+	std::string output = source;
+
+	// DONE: student need to change the next line from output[i] = source[i]
+	// transform each character based on an xor of the key, a vector at a time where the cpu allows
+	xor_buffer(source.data(), &output[0], source_length, cached_key_pattern(key), key_length, 0);
+
+	// our output length must equal our source length
+	assert(output.length() == source_length);
+
+	// return the transformed string
+	return output;
+}
+
+/// <summary>
+/// encrypt or decrypt a string the caller no longer needs, reusing its storage for the result
+/// </summary>
+/// <param name="source">input string to process, moved from</param>
+/// <param name="key">key to use in encryption / decryption</param>
+/// <returns>transformed string, in the source's buffer</returns>
+std::string encrypt_decrypt(std::string&& source, const std::string& key)
+{
+	const auto key_length = key.length();
+	const auto source_length = source.length();
+
+	assert(key_length > 0);
+	assert(source_length > 0);
+
+	std::string output = std::move(source);
+	xor_buffer(output.data(), &output[0], source_length, cached_key_pattern(key), key_length, 0);
+
+	return output;
+}
+
+/// <summary>
+/// encrypt or decrypt a buffer in place using the provided key, no allocation once the key is cached
+/// </summary>
+/// <param name="data">bytes to transform in place</param>
+/// <param name="key">key to use in encryption / decryption</param>
+void encrypt_decrypt(std::span<std::byte> data, const std::string& key)
+{
+	assert(key.length() > 0);
+
+	char* bytes = reinterpret_cast<char*>(data.data());
+	xor_buffer(bytes, bytes, data.size(), cached_key_pattern(key), key.length(), 0);
+}
+
+/// <summary>
+/// encrypt or decrypt a buffer into a caller supplied buffer, no allocation once the key is cached
+/// </summary>
+/// <param name="source">bytes to transform</param>
+/// <param name="output">destination, at least as large as source</param>
+/// <param name="key">key to use in encryption / decryption</param>
+void encrypt_decrypt(std::span<const std::byte> source, std::span<std::byte> output, const std::string& key)
+{
+	assert(key.length() > 0);
+	assert(output.size() >= source.size());
+
+	xor_buffer(reinterpret_cast<const char*>(source.data()), reinterpret_cast<char*>(output.data()), source.size(), cached_key_pattern(key), key.length(), 0);
+}
+
+/// <summary>
+/// ChaCha20 (RFC 8439) state for a key / nonce pair: 4 constant words, 8 key words,
+/// the 32 bit block counter and 3 nonce words
+/// </summary>
+struct chacha20_key
+{
+	uint32_t state[16];
+};
+
+static uint32_t load_le32(const char* bytes)
+{
+	const auto* b = reinterpret_cast<const unsigned char*>(bytes);
+	return static_cast<uint32_t>(b[0]) | (static_cast<uint32_t>(b[1]) << 8) | (static_cast<uint32_t>(b[2]) << 16) | (static_cast<uint32_t>(b[3]) << 24);
+}
+
+/// <summary>
+/// build the ChaCha20 state from raw key and nonce bytes
+/// </summary>
+/// <param name="key">exactly 32 bytes of key</param>
+/// <param name="nonce">exactly 12 bytes of nonce, never reuse one with the same key</param>
+/// <param name="counter">block counter of the first keystream block</param>
+/// <returns>the initial cipher state</returns>
+chacha20_key make_chacha20_key(const std::string& key, const std::string& nonce, uint32_t counter = 0)
+{
+	assert(key.length() == 32);
+	assert(nonce.length() == 12);
+
+	chacha20_key result;
+	result.state[0] = 0x61707865; // "expand 32-byte k"
+	result.state[1] = 0x3320646e;
+	result.state[2] = 0x79622d32;
+	result.state[3] = 0x6b206574;
+	for (int i = 0; i < 8; ++i)
+	{
+		result.state[4 + i] = load_le32(key.data() + 4 * i);
+	}
+	result.state[12] = counter;
+	for (int i = 0; i < 3; ++i)
+	{
+		result.state[13 + i] = load_le32(nonce.data() + 4 * i);
+	}
+
+	return result;
+}
+
+static inline uint32_t rotl32(uint32_t value, int count)
+{
+	return (value << count) | (value >> (32 - count));
+}
+
+#define CHACHA20_QUARTER_ROUND(a, b, c, d) \
+	a += b; d ^= a; d = rotl32(d, 16); \
+	c += d; b ^= c; b = rotl32(b, 12); \
+	a += b; d ^= a; d = rotl32(d, 8); \
+	c += d; b ^= c; b = rotl32(b, 7);
+
+/// <summary>
+/// generate one 64 byte keystream block
+/// </summary>
+/// <param name="state">cipher state, state[12] is ignored in favour of counter</param>
+/// <param name="counter">block counter</param>
+/// <param name="block">64 bytes of keystream out</param>
+static void chacha20_block(const uint32_t state[16], uint32_t counter, unsigned char block[64])
+{
+	uint32_t x[16];
+	std::memcpy(x, state, sizeof x);
+	x[12] = counter;
+
+	for (int round = 0; round < 10; ++round)
+	{
+		CHACHA20_QUARTER_ROUND(x[0], x[4], x[8], x[12]);
+		CHACHA20_QUARTER_ROUND(x[1], x[5], x[9], x[13]);
+		CHACHA20_QUARTER_ROUND(x[2], x[6], x[10], x[14]);
+		CHACHA20_QUARTER_ROUND(x[3], x[7], x[11], x[15]);
+		CHACHA20_QUARTER_ROUND(x[0], x[5], x[10], x[15]);
+		CHACHA20_QUARTER_ROUND(x[1], x[6], x[11], x[12]);
+		CHACHA20_QUARTER_ROUND(x[2], x[7], x[8], x[13]);
+		CHACHA20_QUARTER_ROUND(x[3], x[4], x[9], x[14]);
+	}
+
+	for (int i = 0; i < 16; ++i)
+	{
+		const uint32_t word = x[i] + (i == 12 ? counter : state[i]);
+		block[4 * i + 0] = static_cast<unsigned char>(word);
+		block[4 * i + 1] = static_cast<unsigned char>(word >> 8);
+		block[4 * i + 2] = static_cast<unsigned char>(word >> 16);
+		block[4 * i + 3] = static_cast<unsigned char>(word >> 24);
+	}
+}
+
+/// <summary>
+/// signature shared by the multi-block kernels. each kernel handles whole groups of blocks only,
+/// starting at block counter, and returns how many bytes it consumed
+/// </summary>
+typedef size_t(*chacha20_kernel)(const uint32_t state[16], uint32_t counter, const char* source, char* output, size_t length);
+
+static size_t chacha20_kernel_none(const uint32_t*, uint32_t, const char*, char*, size_t)
+{
+	return 0;
+}
+
+#ifdef XOR_KERNEL_X86
+// the vector kernels run the quarter round on one word from each of 4 (sse2) or 8 (avx2) blocks at once
+#define CHACHA20_SSE2_ROTL(v, n) _mm_or_si128(_mm_slli_epi32(v, n), _mm_srli_epi32(v, 32 - (n)))
+
+#define CHACHA20_SSE2_QUARTER_ROUND(a, b, c, d) \
+	a = _mm_add_epi32(a, b); d = _mm_xor_si128(d, a); d = CHACHA20_SSE2_ROTL(d, 16); \
+	c = _mm_add_epi32(c, d); b = _mm_xor_si128(b, c); b = CHACHA20_SSE2_ROTL(b, 12); \
+	a = _mm_add_epi32(a, b); d = _mm_xor_si128(d, a); d = CHACHA20_SSE2_ROTL(d, 8); \
+	c = _mm_add_epi32(c, d); b = _mm_xor_si128(b, c); b = CHACHA20_SSE2_ROTL(b, 7);
+
+static size_t chacha20_kernel_sse2(const uint32_t state[16], uint32_t counter, const char* source, char* output, size_t length)
+{
+	size_t i = 0;
+	for (; i + 256 <= length; i += 256, counter += 4)
+	{
+		__m128i x[16];
+		__m128i input[16];
+		for (int j = 0; j < 16; ++j)
+		{
+			input[j] = _mm_set1_epi32(static_cast<int>(state[j]));
+		}
+		input[12] = _mm_add_epi32(_mm_set1_epi32(static_cast<int>(counter)), _mm_set_epi32(3, 2, 1, 0));
+		for (int j = 0; j < 16; ++j)
+		{
+			x[j] = input[j];
+		}
+
+		for (int round = 0; round < 10; ++round)
+		{
+			CHACHA20_SSE2_QUARTER_ROUND(x[0], x[4], x[8], x[12]);
+			CHACHA20_SSE2_QUARTER_ROUND(x[1], x[5], x[9], x[13]);
+			CHACHA20_SSE2_QUARTER_ROUND(x[2], x[6], x[10], x[14]);
+			CHACHA20_SSE2_QUARTER_ROUND(x[3], x[7], x[11], x[15]);
+			CHACHA20_SSE2_QUARTER_ROUND(x[0], x[5], x[10], x[15]);
+			CHACHA20_SSE2_QUARTER_ROUND(x[1], x[6], x[11], x[12]);
+			CHACHA20_SSE2_QUARTER_ROUND(x[2], x[7], x[8], x[13]);
+			CHACHA20_SSE2_QUARTER_ROUND(x[3], x[4], x[9], x[14]);
+		}
+
+		// lane b of x[j] is word j of block b, transpose each group of 4 words back into block order
+		for (int group = 0; group < 4; ++group)
+		{
+			const __m128i a = _mm_add_epi32(x[4 * group + 0], input[4 * group + 0]);
+			const __m128i b = _mm_add_epi32(x[4 * group + 1], input[4 * group + 1]);
+			const __m128i c = _mm_add_epi32(x[4 * group + 2], input[4 * group + 2]);
+			const __m128i d = _mm_add_epi32(x[4 * group + 3], input[4 * group + 3]);
+
+			const __m128i ab_low = _mm_unpacklo_epi32(a, b);
+			const __m128i ab_high = _mm_unpackhi_epi32(a, b);
+			const __m128i cd_low = _mm_unpacklo_epi32(c, d);
+			const __m128i cd_high = _mm_unpackhi_epi32(c, d);
+
+			const __m128i block_words[4] = {
+				_mm_unpacklo_epi64(ab_low, cd_low),
+				_mm_unpackhi_epi64(ab_low, cd_low),
+				_mm_unpacklo_epi64(ab_high, cd_high),
+				_mm_unpackhi_epi64(ab_high, cd_high)
+			};
+
+			for (int block = 0; block < 4; ++block)
+			{
+				const size_t offset = i + 64 * block + 16 * group;
+				const __m128i data = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + offset));
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(output + offset), _mm_xor_si128(data, block_words[block]));
+			}
+		}
+	}
+	return i;
+}
+
+#define CHACHA20_AVX2_ROTL(v, n) _mm256_or_si256(_mm256_slli_epi32(v, n), _mm256_srli_epi32(v, 32 - (n)))
+
+#define CHACHA20_AVX2_QUARTER_ROUND(a, b, c, d) \
+	a = _mm256_add_epi32(a, b); d = _mm256_xor_si256(d, a); d = _mm256_shuffle_epi8(d, rotate16); \
+	c = _mm256_add_epi32(c, d); b = _mm256_xor_si256(b, c); b = CHACHA20_AVX2_ROTL(b, 12); \
+	a = _mm256_add_epi32(a, b); d = _mm256_xor_si256(d, a); d = _mm256_shuffle_epi8(d, rotate8); \
+	c = _mm256_add_epi32(c, d); b = _mm256_xor_si256(b, c); b = CHACHA20_AVX2_ROTL(b, 7);
+
+XOR_TARGET("avx2")
+static size_t chacha20_kernel_avx2(const uint32_t state[16], uint32_t counter, const char* source, char* output, size_t length)
+{
+	// byte shuffles are cheaper than shift / shift / or for the rotates that are whole bytes
+	const __m256i rotate16 = _mm256_set_epi8(
+		13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2,
+		13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2);
+	const __m256i rotate8 = _mm256_set_epi8(
+		14, 13, 12, 15, 10, 9, 8, 11, 6, 5, 4, 7, 2, 1, 0, 3,
+		14, 13, 12, 15, 10, 9, 8, 11, 6, 5, 4, 7, 2, 1, 0, 3);
+
+	size_t i = 0;
+	for (; i + 512 <= length; i += 512, counter += 8)
+	{
+		__m256i x[16];
+		for (int j = 0; j < 16; ++j)
+		{
+			x[j] = _mm256_set1_epi32(static_cast<int>(state[j]));
+		}
+		const __m256i counters = _mm256_add_epi32(_mm256_set1_epi32(static_cast<int>(counter)), _mm256_set_epi32(7, 6, 5, 4, 3, 2, 1, 0));
+		x[12] = counters;
+
+		for (int round = 0; round < 10; ++round)
+		{
+			CHACHA20_AVX2_QUARTER_ROUND(x[0], x[4], x[8], x[12]);
+			CHACHA20_AVX2_QUARTER_ROUND(x[1], x[5], x[9], x[13]);
+			CHACHA20_AVX2_QUARTER_ROUND(x[2], x[6], x[10], x[14]);
+			CHACHA20_AVX2_QUARTER_ROUND(x[3], x[7], x[11], x[15]);
+			CHACHA20_AVX2_QUARTER_ROUND(x[0], x[5], x[10], x[15]);
+			CHACHA20_AVX2_QUARTER_ROUND(x[1], x[6], x[11], x[12]);
+			CHACHA20_AVX2_QUARTER_ROUND(x[2], x[7], x[8], x[13]);
+			CHACHA20_AVX2_QUARTER_ROUND(x[3], x[4], x[9], x[14]);
+		}
+
+		for (int j = 0; j < 16; ++j)
+		{
+			x[j] = _mm256_add_epi32(x[j], j == 12 ? counters : _mm256_set1_epi32(static_cast<int>(state[j])));
+		}
+
+		// lane b of x[j] is word j of block b. transpose each group of 4 words inside the 128 bit halves,
+		// which leaves blocks 0-3 in the low halves and blocks 4-7 in the high halves
+		__m256i groups[4][4];
+		for (int group = 0; group < 4; ++group)
+		{
+			const __m256i ab_low = _mm256_unpacklo_epi32(x[4 * group + 0], x[4 * group + 1]);
+			const __m256i ab_high = _mm256_unpackhi_epi32(x[4 * group + 0], x[4 * group + 1]);
+			const __m256i cd_low = _mm256_unpacklo_epi32(x[4 * group + 2], x[4 * group + 3]);
+			const __m256i cd_high = _mm256_unpackhi_epi32(x[4 * group + 2], x[4 * group + 3]);
+
+			groups[group][0] = _mm256_unpacklo_epi64(ab_low, cd_low);
+			groups[group][1] = _mm256_unpackhi_epi64(ab_low, cd_low);
+			groups[group][2] = _mm256_unpacklo_epi64(ab_high, cd_high);
+			groups[group][3] = _mm256_unpackhi_epi64(ab_high, cd_high);
+		}
+
+		// then pair up the halves so each store covers 32 contiguous keystream bytes of one block
+		for (int block = 0; block < 4; ++block)
+		{
+			const __m256i keystream[4] = {
+				_mm256_permute2x128_si256(groups[0][block], groups[1][block], 0x20), // block, words 0-7
+				_mm256_permute2x128_si256(groups[2][block], groups[3][block], 0x20), // block, words 8-15
+				_mm256_permute2x128_si256(groups[0][block], groups[1][block], 0x31), // block + 4, words 0-7
+				_mm256_permute2x128_si256(groups[2][block], groups[3][block], 0x31)  // block + 4, words 8-15
+			};
+			const size_t offsets[4] = {
+				i + 64 * block,
+				i + 64 * block + 32,
+				i + 64 * (block + 4),
+				i + 64 * (block + 4) + 32
+			};
+
+			for (int part = 0; part < 4; ++part)
+			{
+				const __m256i data = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(source + offsets[part]));
+				_mm256_storeu_si256(reinterpret_cast<__m256i*>(output + offsets[part]), _mm256_xor_si256(data, keystream[part]));
+			}
+		}
+	}
+	return i;
+}
+
+static chacha20_kernel detect_chacha20_kernel()
+{
+	// the xor kernel detection already did the cpuid work, reuse its answer
+	const xor_kernel widest = detect_xor_kernel();
+	if (widest == xor_kernel_avx512 || widest == xor_kernel_avx2) return chacha20_kernel_avx2;
+	if (widest == xor_kernel_sse2) return chacha20_kernel_sse2;
+	return chacha20_kernel_none;
+}
+#else
+static chacha20_kernel detect_chacha20_kernel()
+{
+	return chacha20_kernel_none;
+}
+#endif
+
+// the block counter is 32 bits, so one key / nonce pair has 2^32 blocks (256 GB) of keystream
+constexpr uint64_t chacha20_block_limit = 1ull << 32;
+
+/// <summary>
+/// check a range of the stream stays inside the keystream, past the last block the counter would
+/// wrap and the same keystream would be used twice
+/// </summary>
+/// <param name="key">cipher state from make_chacha20_key()</param>
+/// <param name="stream_offset">stream position of the first byte</param>
+/// <param name="length">number of bytes</param>
+/// <returns>true if every byte has its own keystream</returns>
+bool chacha20_range_fits(const chacha20_key& key, uint64_t stream_offset, size_t length)
+{
+	if (length > UINT64_MAX - 63 || stream_offset > UINT64_MAX - 63 - length) return false; // the end would not fit in 64 bits
+	return key.state[12] + (stream_offset + length + 63) / 64 <= chacha20_block_limit;
+}
+
+/// <summary>
+/// xor a buffer with the ChaCha20 keystream starting at an arbitrary byte of the stream. like xor_buffer
+/// this is its own inverse, so the same call encrypts and decrypts. the block counter is 32 bits, so one
+/// key / nonce pair covers 256 GB of stream, a range past that is refused rather than wrapping around
+/// </summary>
+/// <param name="source">bytes to transform</param>
+/// <param name="output">destination, may be the same as source</param>
+/// <param name="length">number of bytes to transform</param>
+/// <param name="key">cipher state from make_chacha20_key()</param>
+/// <param name="stream_offset">stream position of source[0]</param>
+/// <returns>false, with nothing written, if the range runs past the end of the keystream</returns>
+bool chacha20_xor(const char* source, char* output, size_t length, const chacha20_key& key, uint64_t stream_offset)
+{
+	static const chacha20_kernel kernel = detect_chacha20_kernel();
+
+	if (!chacha20_range_fits(key, stream_offset, length))
+	{
+		return false;
+	}
+
+	uint32_t counter = key.state[12] + static_cast<uint32_t>(stream_offset / 64);
+	size_t skip = static_cast<size_t>(stream_offset % 64);
+	size_t i = 0;
+	unsigned char block[64];
+
+	// finish off a partial block if we start part way into one
+	if (skip != 0 && length > 0)
+	{
+		chacha20_block(key.state, counter++, block);
+		for (; i < length && skip < 64; ++i, ++skip)
+		{
+			output[i] = source[i] ^ static_cast<char>(block[skip]);
+		}
+	}
+
+	// 4 or 8 blocks at a time
+	const size_t done = kernel(key.state, counter, source + i, output + i, length - i);
+	counter += static_cast<uint32_t>(done / 64);
+	i += done;
+
+	// whatever is left, a block at a time
+	while (i < length)
+	{
+		chacha20_block(key.state, counter++, block);
+		for (size_t j = 0; j < 64 && i < length; ++i, ++j)
+		{
+			output[i] = source[i] ^ static_cast<char>(block[j]);
+		}
+	}
+	return true;
+}
+
+/// <summary>
+/// encrypt or decrypt a source string with the ChaCha20 keystream instead of a repeating key
+/// </summary>
+/// <param name="source">input string to process</param>
+/// <param name="key">cipher state from make_chacha20_key()</param>
+/// <returns>transformed string</returns>
+std::string encrypt_decrypt(const std::string& source, const chacha20_key& key)
+{
+	const auto source_length = source.length();
+	assert(source_length > 0);
+
+	std::string output(source_length, '\0');
+	if (!chacha20_xor(source.data(), &output[0], source_length, key, 0)) {
+		std::cerr << "The source is longer than the ChaCha20 keystream - " << source_length << " bytes" << std::endl;
+		exit(EXIT_FAILURE);
+	}
+
+	assert(output.length() == source_length);
+
+	return output;
+}
+
+/// <summary>
+/// thread pool where each worker owns a deque of tasks. a worker runs its own tasks newest first and,
+/// when it runs dry, steals the oldest task from another worker, so a big job that fans out into
+/// sub-tasks gets spread over every idle core instead of sitting on the worker that found it
+/// </summary>
+class work_stealing_pool
+{
+public:
+	explicit work_stealing_pool(unsigned thread_count = 0)
+	{
+		if (thread_count == 0)
+		{
+			thread_count = std::max(1u, std::thread::hardware_concurrency());
+		}
+
+		for (unsigned i = 0; i < thread_count; ++i)
+		{
+			queues_.push_back(std::make_unique<worker_queue>());
+		}
+		for (unsigned i = 0; i < thread_count; ++i)
+		{
+			threads_.emplace_back(&work_stealing_pool::run, this, i);
+		}
+	}
+
+	work_stealing_pool(const work_stealing_pool&) = delete;
+	work_stealing_pool& operator=(const work_stealing_pool&) = delete;
+
+	~work_stealing_pool()
+	{
+		wait();
+		{
+			std::lock_guard<std::mutex> lock(wake_mutex_);
+			stopping_ = true;
+		}
+		wake_.notify_all();
+
+		for (auto& thread : threads_)
+		{
+			thread.join();
+		}
+	}
+
+	/// <summary>
+	/// queue a task. from a worker it goes on that worker's own deque, from outside the pool
+	/// the deques are filled round robin
+	/// </summary>
+	/// <param name="task">work to run</param>
+	void submit(std::function<void()> task)
+	{
+		const size_t index = current_pool_ == this ? current_index_ : next_queue_++ % queues_.size();
+
+		++pending_;
+		{
+			std::lock_guard<std::mutex> lock(wake_mutex_);
+			++queued_;
+		}
+		{
+			std::lock_guard<std::mutex> lock(queues_[index]->mutex);
+			queues_[index]->tasks.push_back(std::move(task));
+		}
+		wake_.notify_one();
+	}
+
+	/// <summary>
+	/// block until every submitted task, including tasks submitted by tasks, has finished
+	/// </summary>
+	void wait()
+	{
+		std::unique_lock<std::mutex> lock(wake_mutex_);
+		idle_.wait(lock, [this]() { return pending_ == 0; });
+	}
+
+	size_t size() const { return threads_.size(); }
+
+private:
+	struct worker_queue
+	{
+		std::mutex mutex;
+		std::deque<std::function<void()>> tasks;
+	};
+
+	bool try_take(size_t index, std::function<void()>& task)
+	{
+		{ // own work first, newest task is the one most likely still in cache
+			std::lock_guard<std::mutex> lock(queues_[index]->mutex);
+			if (!queues_[index]->tasks.empty())
+			{
+				task = std::move(queues_[index]->tasks.back());
+				queues_[index]->tasks.pop_back();
+				return true;
+			}
+		}
+
+		// then steal the oldest task from the next worker that has any
+		for (size_t i = 1; i < queues_.size(); ++i)
+		{
+			worker_queue& victim = *queues_[(index + i) % queues_.size()];
+			std::lock_guard<std::mutex> lock(victim.mutex);
+			if (!victim.tasks.empty())
+			{
+				task = std::move(victim.tasks.front());
+				victim.tasks.pop_front();
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	void run(size_t index)
+	{
+		current_pool_ = this;
+		current_index_ = index;
+
+		std::function<void()> task;
+		for (;;)
+		{
+			if (try_take(index, task))
+			{
+				--queued_;
+				task();
+				task = nullptr;
+
+				if (--pending_ == 0)
+				{
+					std::lock_guard<std::mutex> lock(wake_mutex_);
+					idle_.notify_all();
+				}
+				continue;
+			}
+
+			std::unique_lock<std::mutex> lock(wake_mutex_);
+			if (queued_ > 0)
+			{ // a task is counted but not pushed yet, it will be there in a moment
+				lock.unlock();
+				std::this_thread::yield();
+				continue;
+			}
+			wake_.wait(lock, [this]() { return stopping_ || queued_ > 0; });
+			if (stopping_ && queued_ == 0)
+			{
+				return;
+			}
+		}
+	}
+
+	std::vector<std::unique_ptr<worker_queue>> queues_;
+	std::vector<std::thread> threads_;
+	std::atomic<size_t> pending_{ 0 };
+	std::atomic<size_t> queued_{ 0 };
+	std::atomic<size_t> next_queue_{ 0 };
+	std::mutex wake_mutex_;
+	std::condition_variable wake_;
+	std::condition_variable idle_;
+	bool stopping_ = false;
+
+	static thread_local work_stealing_pool* current_pool_;
+	static thread_local size_t current_index_;
+};
+
+thread_local work_stealing_pool* work_stealing_pool::current_pool_ = nullptr;
+thread_local size_t work_stealing_pool::current_index_ = 0;
+
+// work unit for the parallel xor, sized to sit in a core's L2 while it is being transformed
+constexpr size_t parallel_chunk_size = 512 * 1024;
+
+/// <summary>
+/// xor a buffer against a repeating key across several threads. the buffer is cut into chunks that
+/// threads claim one at a time, each chunk starts at key phase (key_offset + chunk start) so the
+/// result is byte for byte the same as a single xor_buffer call
+/// </summary>
+/// <param name="source">bytes to transform</param>
+/// <param name="output">destination, may be the same as source</param>
+/// <param name="length">number of bytes to transform</param>
+/// <param name="pattern">key expanded with expand_key()</param>
+/// <param name="key_length">length of the original key</param>
+/// <param name="key_offset">stream position of source[0]</param>
+/// <param name="thread_count">threads to use including the caller, 0 for one per hardware thread</param>
+void parallel_xor_buffer(const char* source, char* output, size_t length, const std::string& pattern, size_t key_length, size_t key_offset, unsigned thread_count = 0)
+{
+	const size_t chunk_count = (length + parallel_chunk_size - 1) / parallel_chunk_size;
+
+	if (thread_count == 0)
+	{ // asking the os is not free (it reads the cpu affinity), and the answer does not change
+		static const unsigned hardware_threads = std::max(1u, std::thread::hardware_concurrency());
+		thread_count = hardware_threads;
+	}
+	thread_count = static_cast<unsigned>(std::min<size_t>(thread_count, chunk_count));
+
+	if (thread_count <= 1)
+	{ // not enough work to be worth handing out
+		xor_buffer(source, output, length, pattern, key_length, key_offset);
+		return;
+	}
+
+	// chunks are handed out dynamically so a slow core does not hold everyone else up. helpers
+	// come from a pool that lives as long as the program, so a call costs a few queue pushes
+	// instead of starting and joining threads
+	struct xor_job
+	{
+		std::atomic<size_t> next_chunk{ 0 };
+		size_t done_chunks = 0;
+		std::mutex mutex;
+		std::condition_variable finished;
+	};
+	static work_stealing_pool helpers(std::max(2u, std::thread::hardware_concurrency()) - 1);
+
+	// shared, a helper the pool gets to after the work is done must still find the counters
+	auto job = std::make_shared<xor_job>();
+	auto worker = [job, source, output, length, &pattern, key_length, key_offset, chunk_count]()
+	{
+		size_t done = 0;
+		for (size_t chunk = job->next_chunk++; chunk < chunk_count; chunk = job->next_chunk++)
+		{
+			const size_t begin = chunk * parallel_chunk_size;
+			const size_t count = std::min(parallel_chunk_size, length - begin);
+			xor_buffer(source + begin, output + begin, count, pattern, key_length, key_offset + begin);
+			++done;
+		}
+		if (done == 0) return;
+
+		std::lock_guard<std::mutex> lock(job->mutex);
+		job->done_chunks += done;
+		if (job->done_chunks == chunk_count) job->finished.notify_all();
+	};
+
+	const size_t helper_count = std::min<size_t>(thread_count - 1, helpers.size());
+	for (size_t i = 0; i < helper_count; ++i)
+	{
+		helpers.submit(worker);
+	}
+	worker(); // the calling thread takes a share too
+
+	// wait for the chunks, not the helpers, so a helper that never got started costs nothing
+	std::unique_lock<std::mutex> lock(job->mutex);
+	job->finished.wait(lock, [&]() { return job->done_chunks == chunk_count; });
+}
+
+/// <summary>
+/// encrypt or decrypt a source string using the provided key, spread across threads
+/// </summary>
+/// <param name="source">input string to process</param>
+/// <param name="key">key to use in encryption / decryption</param>
+/// <param name="thread_count">threads to use, 0 for one per hardware thread</param>
+/// <returns>transformed string, identical to encrypt_decrypt(source, key)</returns>
+std::string encrypt_decrypt_parallel(const std::string& source, const std::string& key, unsigned thread_count = 0)
+{
+	const auto key_length = key.length();
+	const auto source_length = source.length();
+
+	assert(key_length > 0);
+	assert(source_length > 0);
+
+	// every byte gets written by a worker, so skip copying the source in first
+	std::string output(source_length, '\0');
+	parallel_xor_buffer(source.data(), &output[0], source_length, expand_key(key), key_length, 0, thread_count);
+
+	assert(output.length() == source_length);
+
+	return output;
+}
+
+// block size for the streaming mode, large enough to keep the vector kernels busy, small enough to stay in L2
+constexpr size_t stream_block_size = 256 * 1024;
+
+std::string read_file(const std::string& filename)
+{
+	// DONE: implement loading the file into a string
+	std::ifstream input_stream(filename);
+
+	if (!input_stream.is_open()) {
+		std::cerr << "Could not open the file - '"
+			<< filename << "'" << std::endl;
+		exit(EXIT_FAILURE);
+	}
+
+	std::string file_text((std::istreambuf_iterator<char>(input_stream)),
+		(std::istreambuf_iterator<char>()));
+
+	return file_text;
+}
+
+std::string get_student_name(const std::string& string_data)
+{
+	std::string student_name;
+
+	// find the first newline
+	size_t pos = string_data.find('\n');
+	// did we find a newline
+	if (pos != std::string::npos)
+	{ // we did, so copy that substring as the student name
+		student_name = string_data.substr(0, pos);
+	}
+
+	return student_name;
+}
+
+/// <summary>
+/// today's date in UTC as yyyy-mm-dd
+/// </summary>
+/// <returns>the date string</returns>
+std::string get_utc_date()
+{
+	time_t t = time(NULL);
+	struct tm tm;
+	char time_str_buffer[26];
+
+	// Use UTC date
+	gmtime_s(&tm ,&t);
+	strftime(time_str_buffer, sizeof time_str_buffer, "%F", &tm);
+
+	return time_str_buffer;
+}
+
+/// <summary>
+/// write the data file header
+///  Line 1: student name
+///  Line 2: timestamp (yyyy-mm-dd)
+///  Line 3: key used
+///  Line 4: blank
+/// </summary>
+/// <param name="output_stream">stream to write the header to</param>
+/// <param name="student_name">student name for line 1</param>
+/// <param name="key">key for line 3</param>
+void write_file_header(std::ostream& output_stream, const std::string& student_name, const std::string& key)
+{
+	// plain newlines, the stream is flushed once when the caller is done with it rather than per line
+	output_stream
+		<< student_name << '\n'
+		<< get_utc_date() << '\n'
+		<< key << '\n'
+		<< '\n';
+}
+
+/// <summary>
+/// get the student name (first line) from raw file data that is not in a string, e.g. a mapped file
+/// </summary>
+/// <param name="data">file data</param>
+/// <param name="length">bytes of file data</param>
+/// <returns>the first line, empty if there is no newline</returns>
+std::string get_student_name(const char* data, size_t length)
+{
+	const void* newline = length > 0 ? std::memchr(data, '\n', length) : nullptr;
+	if (newline == nullptr)
+	{
+		return std::string();
+	}
+
+	return std::string(data, static_cast<const char*>(newline) - data);
+}
+
+void save_data_file(const std::string& filename, const std::string& student_name, const std::string& key, const std::string& data)
+{
+	//  DONE: implement file saving
+	//  file format
+	//  Line 1: student name
+	//  Line 2: timestamp (yyyy-mm-dd)
+	//  Line 3: key used
+	//  Line 4+: data
+
+	std::ofstream output_stream(filename);
+	write_file_header(output_stream, student_name, key);
+	output_stream << data << '\n';
+}
+
+/// <summary>
+/// double buffered file writer. the caller fills one buffer while a background thread writes the
+/// other with positioned writes (pwrite / WriteFile at an offset), so transforming the next block
+/// overlaps the disk write of the last one. data is written as binary, there is no newline translation
+/// </summary>
+class async_file_writer
+{
+public:
+	explicit async_file_writer(size_t buffer_size = stream_block_size)
+		: buffer_size_(buffer_size)
+	{
+		assert(buffer_size_ > 0);
+		buffers_[0].resize(buffer_size_);
+		buffers_[1].resize(buffer_size_);
+	}
+
+	async_file_writer(const async_file_writer&) = delete;
+	async_file_writer& operator=(const async_file_writer&) = delete;
+	~async_file_writer() { close(); }
+
+	/// <summary>
+	/// create (or truncate) the file and start the writer thread
+	/// </summary>
+	/// <param name="filename">file to write</param>
+	/// <returns>true if the file was opened</returns>
+	bool open(const std::string& filename)
+	{
+		close();
+#ifdef _WIN32
+		file_ = CreateFileA(filename.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+		if (file_ == INVALID_HANDLE_VALUE) return false;
+#else
+		fd_ = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (fd_ < 0) return false;
+#endif
+		failed_ = false;
+		stopping_ = false;
+		file_offset_ = 0;
+		thread_ = std::thread(&async_file_writer::run, this);
+		return true;
+	}
+
+	/// <summary>
+	/// copy data into the current buffer, handing full buffers to the writer thread
+	/// </summary>
+	/// <param name="data">bytes to write</param>
+	/// <param name="length">number of bytes</param>
+	void write(const char* data, size_t length)
+	{
+		while (length > 0)
+		{
+			const size_t count = std::min(length, buffer_size_ - fill_);
+			std::memcpy(&buffers_[current_][fill_], data, count);
+			fill_ += count;
+			data += count;
+			length -= count;
+
+			if (fill_ == buffer_size_)
+			{
+				hand_off();
+			}
+		}
+	}
+
+	void write(const std::string& text)
+	{
+		write(text.data(), text.length());
+	}
+
+	/// <summary>
+	/// hand off anything buffered and wait until the writer thread has written all of it.
+	/// the data is with the os, not necessarily on disk, see sync()
+	/// </summary>
+	/// <returns>false if any write so far has failed</returns>
+	bool flush()
+	{
+		if (fill_ > 0)
+		{
+			hand_off();
+		}
+
+		std::unique_lock<std::mutex> lock(mutex_);
+		written_.wait(lock, [this]() { return !pending_; });
+		return !failed_;
+	}
+
+	/// <summary>
+	/// flush, then ask the os to put the data on disk (fsync / FlushFileBuffers)
+	/// </summary>
+	/// <returns>false if any write or the sync failed</returns>
+	bool sync()
+	{
+		if (!flush() || !is_open()) return false;
+#ifdef _WIN32
+		if (!FlushFileBuffers(file_)) failed_ = true;
+#else
+		if (fsync(fd_) != 0) failed_ = true;
+#endif
+		return !failed_;
+	}
+
+	/// <summary>
+	/// flush, stop the writer thread and close the file
+	/// </summary>
+	/// <returns>false if any write failed</returns>
+	bool close()
+	{
+		if (!is_open()) return !failed_;
+
+		flush();
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			stopping_ = true;
+		}
+		ready_.notify_one();
+		thread_.join();
+
+#ifdef _WIN32
+		CloseHandle(file_);
+		file_ = INVALID_HANDLE_VALUE;
+#else
+		::close(fd_);
+		fd_ = -1;
+#endif
+		return !failed_;
+	}
+
+	bool is_open() const
+	{
+#ifdef _WIN32
+		return file_ != INVALID_HANDLE_VALUE;
+#else
+		return fd_ >= 0;
+#endif
+	}
+
+private:
+	/// <summary>
+	/// give the current buffer to the writer thread and switch to the other one, waiting for
+	/// the writer only if it is still busy with the other one
+	/// </summary>
+	void hand_off()
+	{
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			written_.wait(lock, [this]() { return !pending_; });
+			pending_ = true;
+			pending_index_ = current_;
+			pending_length_ = fill_;
+		}
+		ready_.notify_one();
+
+		current_ ^= 1;
+		fill_ = 0;
+	}
+
+	void run()
+	{
+		for (;;)
+		{
+			int index;
+			size_t length;
+			{
+				std::unique_lock<std::mutex> lock(mutex_);
+				ready_.wait(lock, [this]() { return pending_ || stopping_; });
+				if (!pending_) return;
+				index = pending_index_;
+				length = pending_length_;
+			}
+
+			if (!write_at(buffers_[index].data(), length, file_offset_))
+			{
+				failed_ = true;
+			}
+			file_offset_ += length;
+
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				pending_ = false;
+			}
+			written_.notify_one();
+		}
+	}
+
+	bool write_at(const char* data, size_t length, uint64_t offset)
+	{
+		while (length > 0)
+		{
+#ifdef _WIN32
+			OVERLAPPED position = {};
+			position.Offset = static_cast<DWORD>(offset);
+			position.OffsetHigh = static_cast<DWORD>(offset >> 32);
+			DWORD written = 0;
+			const DWORD count = static_cast<DWORD>(std::min<size_t>(length, 1u << 30));
+			if (!WriteFile(file_, data, count, &written, &position) || written == 0) return false;
+#else
+			const ssize_t written = pwrite(fd_, data, length, static_cast<off_t>(offset));
+			if (written < 0 && errno == EINTR) continue;
+			if (written <= 0) return false;
+#endif
+			data += written;
+			length -= static_cast<size_t>(written);
+			offset += static_cast<uint64_t>(written);
+		}
+		return true;
+	}
+
+	const size_t buffer_size_;
+	std::vector<char> buffers_[2];
+	int current_ = 0;
+	size_t fill_ = 0;
+
+	// shared with the writer thread under mutex_
+	std::mutex mutex_;
+	std::condition_variable ready_;
+	std::condition_variable written_;
+	bool pending_ = false;
+	int pending_index_ = 0;
+	size_t pending_length_ = 0;
+	bool stopping_ = false;
+	std::atomic<bool> failed_{ false };
+
+	// writer thread only
+	uint64_t file_offset_ = 0;
+	std::thread thread_;
+
+#ifdef _WIN32
+	HANDLE file_ = INVALID_HANDLE_VALUE;
+#else
+	int fd_ = -1;
+#endif
+};
+
+/// <summary>
+/// encrypt a file and decrypt the result again a block at a time, so memory use is fixed by the
+/// block size instead of the file size and output is written as soon as the first block is done.
+/// writes go through async_file_writer so the next block is transformed while the last one is written.
+/// produces the same files as read_file / encrypt_decrypt / save_data_file, handled as binary
+/// </summary>
+/// <param name="input_filename">file to encrypt</param>
+/// <param name="encrypted_filename">file to save the encrypted data to</param>
+/// <param name="decrypted_filename">file to save the decrypted data to</param>
+/// <param name="key">key to use in encryption / decryption</param>
+/// <param name="block_size">bytes to read, transform and write per step</param>
+/// <returns>number of data bytes processed</returns>
+size_t stream_data_files(const std::string& input_filename, const std::string& encrypted_filename, const std::string& decrypted_filename, const std::string& key, size_t block_size = stream_block_size)
+{
+	const auto key_length = key.length();
+	assert(key_length > 0);
+	assert(block_size > 0);
+
+	std::ifstream input_stream(input_filename, std::ios::binary);
+
+	if (!input_stream.is_open()) {
+		std::cerr << "Could not open the file - '"
+			<< input_filename << "'" << std::endl;
+		exit(EXIT_FAILURE);
+	}
+
+	// the student name is the first line, same rules as get_student_name
+	std::string student_name;
+	if (!std::getline(input_stream, student_name) || input_stream.eof())
+	{
+		student_name.clear();
+	}
+	input_stream.clear();
+	input_stream.seekg(0);
+
+	async_file_writer encrypted_writer(block_size);
+	async_file_writer decrypted_writer(block_size);
+	if (!encrypted_writer.open(encrypted_filename) || !decrypted_writer.open(decrypted_filename)) {
+		std::cerr << "Could not open the output files - '"
+			<< encrypted_filename << "', '" << decrypted_filename << "'" << std::endl;
+		exit(EXIT_FAILURE);
+	}
+
+	std::ostringstream header_stream;
+	write_file_header(header_stream, student_name, key);
+	encrypted_writer.write(header_stream.str());
+	decrypted_writer.write(header_stream.str());
+
+	const std::string pattern = expand_key(key);
+	std::string source_block(block_size, '\0');
+	std::string output_block(block_size, '\0');
+	size_t offset = 0;
+
+	while (input_stream.read(&source_block[0], block_size) || input_stream.gcount() > 0)
+	{
+		const auto count = static_cast<size_t>(input_stream.gcount());
+
+		// encrypt, then decrypt the encrypted block in place, carrying the key phase across blocks
+		xor_buffer(source_block.data(), &output_block[0], count, pattern, key_length, offset);
+		encrypted_writer.write(output_block.data(), count);
+		xor_buffer(output_block.data(), &output_block[0], count, pattern, key_length, offset);
+		decrypted_writer.write(output_block.data(), count);
+
+		offset += count;
+	}
+
+	encrypted_writer.write("\n", 1);
+	decrypted_writer.write("\n", 1);
+
+	// wait for the last writes to land before reporting success, call sync() instead if it must be on disk
+	if (!encrypted_writer.close() || !decrypted_writer.close()) {
+		std::cerr << "Could not write the output files - '"
+			<< encrypted_filename << "', '" << decrypted_filename << "'" << std::endl;
+		exit(EXIT_FAILURE);
+	}
+
+	return offset;
+}
+
 /// <summary>
-/// encrypt or decrypt a source string using the provided key
+/// a file mapped into memory, read only for input or read / write at a fixed size for output.
+/// unmapped and closed when it goes out of scope
 /// </summary>
-/// <param name="source">input string to process</param>
+class mapped_file
+{
+public:
+	mapped_file() = default;
+	mapped_file(const mapped_file&) = delete;
+	mapped_file& operator=(const mapped_file&) = delete;
+	~mapped_file() { close(); }
+
+	/// <summary>
+	/// map an existing file for reading
+	/// </summary>
+	/// <param name="filename">file to map</param>
+	/// <returns>true if the file was mapped</returns>
+	bool open_read(const std::string& filename)
+	{
+		close();
+#ifdef _WIN32
+		file_ = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+		if (file_ == INVALID_HANDLE_VALUE) return false;
+
+		LARGE_INTEGER file_size;
+		if (!GetFileSizeEx(file_, &file_size)) return false;
+		size_ = static_cast<size_t>(file_size.QuadPart);
+		if (size_ == 0) return true; // nothing to map, but not an error
+
+		mapping_ = CreateFileMappingA(file_, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (mapping_ == NULL) return false;
+		data_ = static_cast<char*>(MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0));
+#else
+		fd_ = ::open(filename.c_str(), O_RDONLY);
+		if (fd_ < 0) return false;
+
+		struct stat file_stat;
+		if (fstat(fd_, &file_stat) != 0) return false;
+		size_ = static_cast<size_t>(file_stat.st_size);
+		if (size_ == 0) return true; // nothing to map, but not an error
+
+		void* address = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd_, 0);
+		if (address == MAP_FAILED) return false;
+		data_ = static_cast<char*>(address);
+		madvise(address, size_, MADV_SEQUENTIAL);
+#endif
+		return data_ != nullptr;
+	}
+
+	/// <summary>
+	/// create (or truncate) a file of exactly size bytes and map it for writing
+	/// </summary>
+	/// <param name="filename">file to create</param>
+	/// <param name="size">final size of the file</param>
+	/// <returns>true if the file was created and mapped</returns>
+	bool create(const std::string& filename, size_t size)
+	{
+		close();
+#ifdef _WIN32
+		file_ = CreateFileA(filename.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (file_ == INVALID_HANDLE_VALUE) return false;
+
+		size_ = size;
+		if (size_ == 0) return true;
+
+		// creating the mapping at this size also extends the file to it
+		const unsigned long long mapping_size = size_;
+		mapping_ = CreateFileMappingA(file_, NULL, PAGE_READWRITE, static_cast<DWORD>(mapping_size >> 32), static_cast<DWORD>(mapping_size), NULL);
+		if (mapping_ == NULL) return false;
+		data_ = static_cast<char*>(MapViewOfFile(mapping_, FILE_MAP_WRITE, 0, 0, size_));
+#else
+		fd_ = ::open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+		if (fd_ < 0) return false;
+
+		size_ = size;
+		if (size_ == 0) return true;
+
+		if (ftruncate(fd_, static_cast<off_t>(size_)) != 0) return false;
+		void* address = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+		if (address == MAP_FAILED) return false;
+		data_ = static_cast<char*>(address);
+#endif
+		return data_ != nullptr;
+	}
+
+	void close()
+	{
+#ifdef _WIN32
+		if (data_ != nullptr) UnmapViewOfFile(data_);
+		if (mapping_ != NULL) CloseHandle(mapping_);
+		if (file_ != INVALID_HANDLE_VALUE) CloseHandle(file_);
+		mapping_ = NULL;
+		file_ = INVALID_HANDLE_VALUE;
+#else
+		if (data_ != nullptr) munmap(data_, size_);
+		if (fd_ >= 0) ::close(fd_);
+		fd_ = -1;
+#endif
+		data_ = nullptr;
+		size_ = 0;
+	}
+
+	char* data() const { return data_; }
+	size_t size() const { return size_; }
+
+private:
+#ifdef _WIN32
+	HANDLE file_ = INVALID_HANDLE_VALUE;
+	HANDLE mapping_ = NULL;
+#else
+	int fd_ = -1;
+#endif
+	char* data_ = nullptr;
+	size_t size_ = 0;
+};
+
+/// <summary>
+/// encrypt a file and decrypt the result again through memory mapped files. the input is never copied
+/// into a string, the xor kernel reads straight from the input mapping and writes straight into the output
+/// mapping. files are handled as binary, so unlike read_file there is no newline translation on windows
+/// </summary>
+/// <param name="input_filename">file to encrypt</param>
+/// <param name="encrypted_filename">file to save the encrypted data to</param>
+/// <param name="decrypted_filename">file to save the decrypted data to</param>
 /// <param name="key">key to use in encryption / decryption</param>
-/// <returns>transformed string</returns>
-std::string encrypt_decrypt(const std::string& source, const std::string& key)
+/// <returns>number of data bytes processed</returns>
+size_t map_data_files(const std::string& input_filename, const std::string& encrypted_filename, const std::string& decrypted_filename, const std::string& key)
 {
-	// get lengths now instead of calling the function every time.
-	// this would have most likely been inlined by the compiler, but design for perfomance.
 	const auto key_length = key.length();
-	const auto source_length = source.length();
-
-	// assert that our input data is good
 	assert(key_length > 0);
-	assert(source_length > 0);
 
-	std::string output = source;
+	mapped_file input;
+	if (!input.open_read(input_filename)) {
+		std::cerr << "Could not map the file - '"
+			<< input_filename << "'" << std::endl;
+		exit(EXIT_FAILURE);
+	}
+
+	const size_t source_length = input.size();
+	const char* source = input.data();
+
+	const std::string student_name = get_student_name(source, source_length);
 
-	// loop through the source string char by char
-	for (size_t i = 0; i < source_length; ++i)
-	{ // DONE: student need to change the next line from output[i] = source[i]
-	  // transform each character based on an xor of the key modded constrained to key length using a mod
-		output[i] = source[i] ^ key[i % key_length];
+	// the header is tiny, build it up front so we know how big to make the outputs
+	std::ostringstream header_stream;
+	write_file_header(header_stream, student_name, key);
+	const std::string header = header_stream.str();
+	const size_t output_length = header.length() + source_length + 1;
+
+	mapped_file encrypted;
+	mapped_file decrypted;
+	if (!encrypted.create(encrypted_filename, output_length) || !decrypted.create(decrypted_filename, output_length)) {
+		std::cerr << "Could not map the output files - '"
+			<< encrypted_filename << "', '" << decrypted_filename << "'" << std::endl;
+		exit(EXIT_FAILURE);
 	}
 
-	// our output length must equal our source length
-	assert(output.length() == source_length);
+	char* encrypted_data = encrypted.data() + header.length();
+	char* decrypted_data = decrypted.data() + header.length();
+	const std::string pattern = expand_key(key);
 
-	// return the transformed string
-	return output;
+	std::memcpy(encrypted.data(), header.data(), header.length());
+	std::memcpy(decrypted.data(), header.data(), header.length());
+	parallel_xor_buffer(source, encrypted_data, source_length, pattern, key_length, 0);
+	parallel_xor_buffer(encrypted_data, decrypted_data, source_length, pattern, key_length, 0);
+	encrypted_data[source_length] = '\n';
+	decrypted_data[source_length] = '\n';
+
+	return source_length;
 }
 
-std::string read_file(const std::string& filename)
+// files larger than this are cut into sub-tasks of this size so one big file can use every core
+constexpr size_t batch_split_size = 4 * 1024 * 1024;
+
+/// <summary>
+/// totals for a batch run, updated by every worker
+/// </summary>
+struct batch_totals
 {
-	// DONE: implement loading the file into a string
-	std::ifstream input_stream(filename);
+	std::atomic<size_t> files{ 0 };
+	std::atomic<size_t> failures{ 0 };
+	std::atomic<size_t> bytes{ 0 };
+};
 
-	if (!input_stream.is_open()) {
-		std::cerr << "Could not open the file - '"
-			<< filename << "'" << std::endl;
-		exit(EXIT_FAILURE);
+/// <summary>
+/// encrypt one file of a batch into a memory mapped output in the save_data_file format. large files
+/// queue their xor as sub-tasks on the pool, the mappings are released when the last one finishes
+/// </summary>
+/// <param name="pool">pool the sub-tasks are queued on</param>
+/// <param name="input_path">file to encrypt</param>
+/// <param name="output_path">encrypted file to write</param>
+/// <param name="key">key to use in encryption</param>
+/// <param name="pattern">the key expanded with expand_key(), must outlive the batch</param>
+/// <param name="totals">batch counters to update</param>
+void encrypt_batch_file(work_stealing_pool& pool, const std::filesystem::path& input_path, const std::filesystem::path& output_path, const std::string& key, const std::string& pattern, batch_totals& totals)
+{
+	struct file_job
+	{
+		mapped_file input;
+		mapped_file output;
+	};
+	auto job = std::make_shared<file_job>();
+
+	if (!job->input.open_read(input_path.string()))
+	{
+		std::cerr << "Could not map the file - '" << input_path.string() << "'" << std::endl;
+		++totals.failures;
+		return;
 	}
 
-	std::string file_text((std::istreambuf_iterator<char>(input_stream)),
-		(std::istreambuf_iterator<char>()));
+	const size_t source_length = job->input.size();
 
-	return file_text;
+	std::ostringstream header_stream;
+	write_file_header(header_stream, get_student_name(job->input.data(), source_length), key);
+	const std::string header = header_stream.str();
+
+	std::error_code error;
+	std::filesystem::create_directories(output_path.parent_path(), error);
+	if (!job->output.create(output_path.string(), header.length() + source_length + 1))
+	{
+		std::cerr << "Could not map the output file - '" << output_path.string() << "'" << std::endl;
+		++totals.failures;
+		return;
+	}
+
+	std::memcpy(job->output.data(), header.data(), header.length());
+	job->output.data()[header.length() + source_length] = '\n';
+
+	const char* source = job->input.data();
+	char* output = job->output.data() + header.length();
+
+	// small files in one go, big files as sub-tasks that idle workers can steal
+	for (size_t begin = 0; begin < source_length; begin += batch_split_size)
+	{
+		const size_t count = std::min(batch_split_size, source_length - begin);
+		if (count == source_length)
+		{
+			xor_buffer(source, output, count, pattern, key.length(), 0);
+			break;
+		}
+
+		pool.submit([job, source, output, begin, count, &pattern, key_length = key.length()]()
+		{
+			xor_buffer(source + begin, output + begin, count, pattern, key_length, begin);
+		});
+	}
+
+	++totals.files;
+	totals.bytes += source_length;
 }
 
-std::string get_student_name(const std::string& string_data)
+/// <summary>
+/// encrypt every file in a directory (recursively) or named in a list file (one path per line)
+/// into an output directory, keeping their relative paths. files are processed concurrently on a work stealing pool
+/// </summary>
+/// <param name="input">directory or list file</param>
+/// <param name="output_directory">where the encrypted files go</param>
+/// <param name="key">key to use in encryption</param>
+/// <param name="thread_count">threads to use, 0 for one per hardware thread</param>
+/// <returns>true if every file was encrypted</returns>
+bool encrypt_batch(const std::string& input, const std::string& output_directory, const std::string& key, unsigned thread_count = 0)
+{
+	namespace fs = std::filesystem;
+
+	// pair of input file / output file
+	std::vector<std::pair<fs::path, fs::path>> files;
+	std::error_code error;
+
+	if (fs::is_directory(input, error))
+	{
+		fs::recursive_directory_iterator entry(input, error);
+		for (; !error && entry != fs::recursive_directory_iterator(); entry.increment(error))
+		{
+			std::error_code status_error;
+			if (entry->is_regular_file(status_error))
+			{
+				files.emplace_back(entry->path(), fs::path(output_directory) / entry->path().lexically_relative(input));
+			}
+			else if (status_error)
+			{
+				std::cerr << "Could not read the file - '" << entry->path().string() << "'" << std::endl;
+				return false;
+			}
+		}
+		if (error)
+		{
+			std::cerr << "Could not read the directory - '" << input << "'" << std::endl;
+			return false;
+		}
+	}
+	else
+	{
+		std::ifstream list_stream(input);
+		if (!list_stream.is_open())
+		{
+			std::cerr << "Could not open the file list - '" << input << "'" << std::endl;
+			return false;
+		}
+
+		std::string line;
+		while (std::getline(list_stream, line))
+		{
+			if (!line.empty() && line.back() == '\r') line.pop_back();
+			if (line.empty()) continue;
+			// keep the path below the output directory, minus any root or leading ..
+			fs::path relative;
+			for (const auto& part : fs::path(line).lexically_normal().relative_path())
+			{
+				if (relative.empty() && part == "..") continue;
+				relative /= part;
+			}
+			files.emplace_back(line, fs::path(output_directory) / relative);
+		}
+	}
+
+	// two inputs can still land on one output (a/x and ../a/x), refuse rather than overwrite
+	std::vector<fs::path> outputs;
+	outputs.reserve(files.size());
+	for (const auto& file : files)
+	{
+		outputs.push_back(file.second.lexically_normal());
+	}
+	std::sort(outputs.begin(), outputs.end());
+	const auto duplicate = std::adjacent_find(outputs.begin(), outputs.end());
+	if (duplicate != outputs.end())
+	{
+		std::cerr << "More than one input file maps to the output file - '" << duplicate->string() << "'" << std::endl;
+		return false;
+	}
+
+	const std::string pattern = expand_key(key);
+	batch_totals totals;
+	const auto start_time = std::chrono::steady_clock::now();
+
+	{
+		work_stealing_pool pool(thread_count);
+		for (const auto& file : files)
+		{
+			pool.submit([&pool, &file, &key, &pattern, &totals]()
+			{
+				encrypt_batch_file(pool, file.first, file.second, key, pattern, totals);
+			});
+		}
+		pool.wait();
+		std::cout << "Batch threads: " << pool.size() << std::endl;
+	} // the pool is joined and every mapping released here, so the elapsed time includes unmapping
+
+	const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start_time;
+	const double seconds = elapsed.count();
+	const double gigabytes = static_cast<double>(totals.bytes) / 1e9;
+
+	std::cout << "Batch encrypted " << totals.files << " of " << files.size() << " files, "
+		<< totals.bytes << " bytes in " << std::fixed << std::setprecision(3) << seconds << "s ("
+		<< (seconds > 0 ? gigabytes / seconds : 0.0) << " GB/s, "
+		<< (seconds > 0 ? static_cast<double>(totals.files) / seconds : 0.0) << " files/s)" << std::endl;
+	std::cout.unsetf(std::ios::floatfield);
+
+	return totals.failures == 0;
+}
+
+// seekable container format, all integers little endian
+//  offset  0: magic "XORCONT1"
+//  offset  8: uint32 version
+//  offset 12: uint32 cipher (0 = repeating key xor)
+//  offset 16: uint64 block size
+//  offset 24: uint64 data length
+//  offset 32: uint64 block count
+//  offset 40: uint64 data offset
+//  offset 48: uint64 index offset
+//  offset 56: uint32 key length
+//  offset 60: uint16 student name length
+//  offset 62: uint16 reserved
+//  offset 64: date (yyyy-mm-dd), then the student name
+//  data offset: encrypted data, one block after another
+//  index offset: per block uint64 file offset, uint64 length
+constexpr char container_magic[8] = { 'X', 'O', 'R', 'C', 'O', 'N', 'T', '1' };
+constexpr uint32_t container_version = 1;
+constexpr uint32_t container_cipher_xor = 0;
+constexpr size_t container_header_size = 64;
+constexpr size_t container_date_size = 10;
+constexpr size_t container_index_entry_size = 16;
+constexpr size_t container_block_size = 64 * 1024;
+
+/// <summary>
+/// the fixed part of a container, as read by read_container_header
+/// </summary>
+struct container_header
 {
+	uint32_t version = container_version;
+	uint32_t cipher = container_cipher_xor;
+	uint64_t block_size = 0;
+	uint64_t data_length = 0;
+	uint64_t block_count = 0;
+	uint64_t data_offset = 0;
+	uint64_t index_offset = 0;
+	uint32_t key_length = 0;
+	std::string date;
 	std::string student_name;
+};
 
-	// find the first newline
-	size_t pos = string_data.find('\n');
-	// did we find a newline
-	if (pos != std::string::npos)
-	{ // we did, so copy that substring as the student name
-		student_name = string_data.substr(0, pos);
+static uint64_t load_le64(const char* bytes)
+{
+	return static_cast<uint64_t>(load_le32(bytes)) | (static_cast<uint64_t>(load_le32(bytes + 4)) << 32);
+}
+
+static void append_le(std::string& bytes, uint64_t value, int width)
+{
+	for (int i = 0; i < width; ++i)
+	{
+		bytes.push_back(static_cast<char>(value >> (8 * i)));
 	}
+}
 
-	return student_name;
+/// <summary>
+/// encrypt a file into the seekable container format. the input is streamed a block at a time and the
+/// block index goes after the data, everything is sized from the input file size up front
+/// </summary>
+/// <param name="input_filename">file to encrypt, its first line is the student name</param>
+/// <param name="container_filename">container to create</param>
+/// <param name="key">key to use in encryption</param>
+/// <param name="block_size">bytes per indexed block</param>
+/// <returns>true if the container was written</returns>
+bool write_container(const std::string& input_filename, const std::string& container_filename, const std::string& key, size_t block_size = container_block_size)
+{
+	const auto key_length = key.length();
+	assert(key_length > 0);
+	assert(block_size > 0);
+
+	std::error_code error;
+	const uint64_t data_length = std::filesystem::file_size(input_filename, error);
+	std::ifstream input_stream(input_filename, std::ios::binary);
+	if (error || !input_stream.is_open())
+	{
+		std::cerr << "Could not open the file - '" << input_filename << "'" << std::endl;
+		return false;
+	}
+
+	std::string student_name;
+	if (!std::getline(input_stream, student_name) || input_stream.eof())
+	{
+		student_name.clear();
+	}
+	input_stream.clear();
+	input_stream.seekg(0);
+	student_name.resize(std::min<size_t>(student_name.length(), 0xFFFF));
+
+	const uint64_t block_count = (data_length + block_size - 1) / block_size;
+	const uint64_t data_offset = container_header_size + container_date_size + student_name.length();
+	const uint64_t index_offset = data_offset + data_length;
+
+	std::string header(container_magic, sizeof container_magic);
+	append_le(header, container_version, 4);
+	append_le(header, container_cipher_xor, 4);
+	append_le(header, block_size, 8);
+	append_le(header, data_length, 8);
+	append_le(header, block_count, 8);
+	append_le(header, data_offset, 8);
+	append_le(header, index_offset, 8);
+	append_le(header, key_length, 4);
+	append_le(header, student_name.length(), 2);
+	append_le(header, 0, 2);
+	assert(header.length() == container_header_size);
+
+	std::string date = get_utc_date();
+	date.resize(container_date_size, ' ');
+	header += date;
+	header += student_name;
+
+	async_file_writer writer(block_size);
+	if (!writer.open(container_filename))
+	{
+		std::cerr << "Could not open the file - '" << container_filename << "'" << std::endl;
+		return false;
+	}
+	writer.write(header);
+
+	const std::string pattern = expand_key(key);
+	std::string block(block_size, '\0');
+	std::string index;
+	index.reserve(static_cast<size_t>(block_count * container_index_entry_size));
+	uint64_t offset = 0;
+
+	while (input_stream.read(&block[0], block_size) || input_stream.gcount() > 0)
+	{
+		const auto count = static_cast<size_t>(input_stream.gcount());
+		xor_buffer(block.data(), &block[0], count, pattern, key_length, offset);
+		writer.write(block.data(), count);
+
+		append_le(index, data_offset + offset, 8);
+		append_le(index, count, 8);
+		offset += count;
+	}
+
+	if (offset != data_length)
+	{ // the file changed while we were reading it, the header would be wrong
+		std::cerr << "File changed while it was being read - '" << input_filename << "'" << std::endl;
+		writer.close();
+		return false;
+	}
+
+	writer.write(index);
+	return writer.close();
 }
 
-void save_data_file(const std::string& filename, const std::string& student_name, const std::string& key, const std::string& data)
+/// <summary>
+/// read and check the fixed header, date and student name of a container
+/// </summary>
+/// <param name="input_stream">container, positioned anywhere</param>
+/// <param name="header">filled in from the container</param>
+/// <returns>true if this is a container we can read</returns>
+bool read_container_header(std::istream& input_stream, container_header& header)
 {
-	//  DONE: implement file saving
-	//  file format
-	//  Line 1: student name
-	//  Line 2: timestamp (yyyy-mm-dd)
-	//  Line 3: key used
-	//  Line 4+: data
+	char fixed[container_header_size];
+	input_stream.seekg(0);
+	if (!input_stream.read(fixed, sizeof fixed) || std::memcmp(fixed, container_magic, sizeof container_magic) != 0)
+	{
+		return false;
+	}
 
-	time_t t = time(NULL);
-	struct tm tm;
-	char time_str_buffer[26];
+	header.version = load_le32(fixed + 8);
+	header.cipher = load_le32(fixed + 12);
+	header.block_size = load_le64(fixed + 16);
+	header.data_length = load_le64(fixed + 24);
+	header.block_count = load_le64(fixed + 32);
+	header.data_offset = load_le64(fixed + 40);
+	header.index_offset = load_le64(fixed + 48);
+	header.key_length = load_le32(fixed + 56);
+	const size_t name_length = static_cast<unsigned char>(fixed[60]) | (static_cast<unsigned char>(fixed[61]) << 8);
 
-	// Use UTC date
-	gmtime_s(&tm ,&t);
-	strftime(time_str_buffer, sizeof time_str_buffer, "%F", &tm);
+	if (header.version != container_version || header.cipher != container_cipher_xor || header.block_size == 0)
+	{
+		return false;
+	}
 
-	std::ofstream output_stream(filename);
-	output_stream
-		<< student_name << std::endl
-		<< time_str_buffer << std::endl
-		<< key << std::endl
-		<< std::endl << data << std::endl;
+	header.date.resize(container_date_size);
+	header.student_name.resize(name_length);
+	input_stream.read(&header.date[0], container_date_size);
+	if (name_length > 0)
+	{
+		input_stream.read(&header.student_name[0], name_length);
+	}
+
+	return static_cast<bool>(input_stream);
+}
+
+/// <summary>
+/// decrypt an arbitrary byte range of a container. only the index entries and blocks that overlap
+/// the range are read, so the cost is proportional to the range, not to the container
+/// </summary>
+/// <param name="container_filename">container to read</param>
+/// <param name="key">key the container was written with</param>
+/// <param name="offset">first data byte wanted</param>
+/// <param name="length">number of data bytes wanted, clipped to the end of the data</param>
+/// <param name="output">the decrypted range</param>
+/// <returns>true if the range was read</returns>
+bool read_container_range(const std::string& container_filename, const std::string& key, uint64_t offset, size_t length, std::string& output)
+{
+	output.clear();
+
+	std::ifstream input_stream(container_filename, std::ios::binary);
+	container_header header;
+	if (!input_stream.is_open() || !read_container_header(input_stream, header))
+	{
+		std::cerr << "Not a readable container - '" << container_filename << "'" << std::endl;
+		return false;
+	}
+	if (key.length() != header.key_length)
+	{
+		std::cerr << "Key does not match container - '" << container_filename << "'" << std::endl;
+		return false;
+	}
+
+	if (offset >= header.data_length || length == 0)
+	{
+		return true;
+	}
+	length = static_cast<size_t>(std::min<uint64_t>(length, header.data_length - offset));
+
+	const uint64_t first_block = offset / header.block_size;
+	const uint64_t last_block = (offset + length - 1) / header.block_size;
+	const size_t entry_count = static_cast<size_t>(last_block - first_block + 1);
+
+	std::string index(entry_count * container_index_entry_size, '\0');
+	input_stream.seekg(static_cast<std::streamoff>(header.index_offset + first_block * container_index_entry_size));
+	if (!input_stream.read(&index[0], static_cast<std::streamsize>(index.length())))
+	{
+		return false;
+	}
+
+	output.resize(length);
+	const std::string& pattern = cached_key_pattern(key);
+	size_t written = 0;
+
+	for (size_t entry = 0; entry < entry_count; ++entry)
+	{
+		const uint64_t block_offset = load_le64(&index[entry * container_index_entry_size]);
+		const uint64_t block_length = load_le64(&index[entry * container_index_entry_size + 8]);
+		const uint64_t block_start = (first_block + entry) * header.block_size;
+
+		// the part of this block inside the wanted range
+		const uint64_t skip = entry == 0 ? offset - block_start : 0;
+		const size_t count = static_cast<size_t>(std::min<uint64_t>(block_length - skip, length - written));
+
+		input_stream.seekg(static_cast<std::streamoff>(block_offset + skip));
+		if (!input_stream.read(&output[written], static_cast<std::streamsize>(count)))
+		{
+			return false;
+		}
+		xor_buffer(&output[written], &output[written], count, pattern, key.length(), static_cast<size_t>(block_start + skip));
+		written += count;
+	}
+
+	return written == length;
+}
+
+/// <summary>
+/// every repeating-key xor kernel this cpu can run, narrowest first, so the benchmark can time each one
+/// </summary>
+/// <returns>pairs of kernel name / kernel</returns>
+std::vector<std::pair<std::string, xor_kernel>> available_xor_kernels()
+{
+	std::vector<std::pair<std::string, xor_kernel>> kernels = { { "xor_scalar", xor_kernel_none } };
+#ifdef XOR_KERNEL_X86
+	const xor_kernel widest = detect_xor_kernel();
+	if (widest != xor_kernel_none) kernels.emplace_back("xor_sse2", xor_kernel_sse2);
+	if (widest == xor_kernel_avx2 || widest == xor_kernel_avx512) kernels.emplace_back("xor_avx2", xor_kernel_avx2);
+	if (widest == xor_kernel_avx512) kernels.emplace_back("xor_avx512", xor_kernel_avx512);
+#endif
+	return kernels;
+}
+
+// each measurement repeats until it has run at least this long, so tiny payloads are not all timer noise
+constexpr double benchmark_min_seconds = 0.1;
+
+static uint64_t read_cycle_counter()
+{
+#ifdef XOR_KERNEL_X86
+	return __rdtsc();
+#else
+	return 0;
+#endif
+}
+
+/// <summary>
+/// high water mark of the process resident set so far. the os keeps one figure for the life of the
+/// process, so it never goes down and cannot be split between the things the process has done
+/// </summary>
+/// <returns>peak resident bytes, 0 if the os will not tell us</returns>
+static size_t peak_rss_bytes()
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof counters))
+	{
+		return counters.PeakWorkingSetSize;
+	}
+	return 0;
+#else
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#ifdef __APPLE__
+	return static_cast<size_t>(usage.ru_maxrss); // bytes on macOS
+#else
+	return static_cast<size_t>(usage.ru_maxrss) * 1024; // kilobytes on linux
+#endif
+#endif
+}
+
+/// <summary>
+/// time one implementation path on one payload and write the result as a JSON line:
+///  {"path", "bytes", "key_length", "iterations", "seconds", "gb_per_s", "cycles_per_byte", "process_peak_rss_bytes"}
+/// seconds is per iteration, cycles are time stamp counter ticks (0 where there is no counter).
+/// process_peak_rss_bytes is the whole sweep's high water mark so far, not this path's own footprint,
+/// a path only shows up in it when it pushes the mark higher than every path before it
+/// </summary>
+/// <param name="report">stream the JSON line goes to</param>
+/// <param name="path">name of the implementation path</param>
+/// <param name="bytes">payload bytes processed per iteration</param>
+/// <param name="key_length">key length used</param>
+/// <param name="run">one iteration of the work</param>
+template <typename Work>
+void run_benchmark(std::ostream& report, const std::string& path, size_t bytes, size_t key_length, Work&& run)
+{
+	run(); // warm up caches, page in buffers, pick kernels
+
+	size_t iterations = 0;
+	const auto start_time = std::chrono::steady_clock::now();
+	const uint64_t start_cycles = read_cycle_counter();
+	std::chrono::duration<double> elapsed{ 0 };
+	do
+	{
+		run();
+		++iterations;
+		elapsed = std::chrono::steady_clock::now() - start_time;
+	} while (elapsed.count() < benchmark_min_seconds);
+	const uint64_t cycles = read_cycle_counter() - start_cycles;
+
+	const double seconds = elapsed.count() / static_cast<double>(iterations);
+	const double total_bytes = static_cast<double>(bytes) * static_cast<double>(iterations);
+
+	std::ostringstream line;
+	line << std::setprecision(6)
+		<< "{\"path\":\"" << path << "\""
+		<< ",\"bytes\":" << bytes
+		<< ",\"key_length\":" << key_length
+		<< ",\"iterations\":" << iterations
+		<< ",\"seconds\":" << seconds
+		<< ",\"gb_per_s\":" << (seconds > 0 ? static_cast<double>(bytes) / seconds / 1e9 : 0.0)
+		<< ",\"cycles_per_byte\":" << (total_bytes > 0 ? static_cast<double>(cycles) / total_bytes : 0.0)
+		<< ",\"process_peak_rss_bytes\":" << peak_rss_bytes()
+		<< "}";
+	report << line.str() << std::endl; // one flush per result so a crashed sweep keeps what it had
+}
+
+/// <summary>
+/// sweep payload sizes (1 KB up to max_bytes, 16x per step) across every implementation path,
+/// and key lengths (1 to 4096 bytes) across the xor kernels, reporting one JSON line per result
+/// </summary>
+/// <param name="report">stream the JSON lines go to</param>
+/// <param name="max_bytes">largest payload to try, capped at 4 GB</param>
+void run_benchmarks(std::ostream& report, size_t max_bytes)
+{
+	const unsigned long long four_gb = 4ull * 1024 * 1024 * 1024;
+	max_bytes = static_cast<size_t>(std::min<unsigned long long>(max_bytes, four_gb));
+
+	std::vector<size_t> sizes;
+	for (unsigned long long size = 1024; size <= max_bytes; size *= 16)
+	{
+		sizes.push_back(static_cast<size_t>(size));
+	}
+	if (max_bytes == four_gb)
+	{
+		sizes.push_back(max_bytes);
+	}
+
+	const size_t key_lengths[] = { 1, 7, 8, 64, 509, 4096 };
+	const std::string key = "password";
+	const chacha20_key stream_key = make_chacha20_key("benchmark key, 32 bytes, not one", "nonce 12 byt");
+	const auto kernels = available_xor_kernels();
+
+	const std::string input_file_name = "benchmark_input.tmp";
+	const std::string encrypted_file_name = "benchmark_encrypted.tmp";
+	const std::string decrypted_file_name = "benchmark_decrypted.tmp";
+
+	for (const size_t bytes : sizes)
+	{
+		try
+		{
+			std::string source(bytes, 'x');
+			std::string output(bytes, '\0');
+			source[0] = 'n';
+			source[1] = '\n'; // a student name line for the file paths
+
+			for (const size_t key_length : key_lengths)
+			{
+				std::string sweep_key(key_length, '\0');
+				for (size_t i = 0; i < key_length; ++i)
+				{
+					sweep_key[i] = static_cast<char>('a' + i % 26);
+				}
+				const std::string pattern = expand_key(sweep_key);
+
+				for (const auto& kernel : kernels)
+				{
+					run_benchmark(report, kernel.first, bytes, key_length, [&]()
+					{
+						xor_buffer_with(kernel.second, source.data(), &output[0], bytes, pattern, key_length, 0);
+					});
+				}
+
+				run_benchmark(report, "xor_parallel", bytes, key_length, [&]()
+				{
+					parallel_xor_buffer(source.data(), &output[0], bytes, pattern, key_length, 0);
+				});
+			}
+
+			run_benchmark(report, "encrypt_decrypt", bytes, key.length(), [&]()
+			{
+				output = encrypt_decrypt(source, key);
+			});
+
+			run_benchmark(report, "encrypt_decrypt_in_place", bytes, key.length(), [&]()
+			{
+				encrypt_decrypt(std::as_writable_bytes(std::span<char>(output)), key);
+			});
+
+			run_benchmark(report, "chacha20", bytes, 32, [&]()
+			{
+				chacha20_xor(source.data(), &output[0], bytes, stream_key, 0);
+			});
+
+			// file paths, on a file of this size in the current directory
+			{
+				std::ofstream input_stream(input_file_name, std::ios::binary);
+				input_stream.write(source.data(), static_cast<std::streamsize>(bytes));
+			}
+			output.clear();
+			output.shrink_to_fit();
+
+			run_benchmark(report, "read_file", bytes, 0, [&]()
+			{
+				output = read_file(input_file_name);
+			});
+
+			run_benchmark(report, "save_data_file", bytes, key.length(), [&]()
+			{
+				save_data_file(encrypted_file_name, "n", key, source);
+			});
+
+			// the two file modes encrypt and decrypt, so each iteration does the work twice
+			run_benchmark(report, "stream_data_files", bytes, key.length(), [&]()
+			{
+				stream_data_files(input_file_name, encrypted_file_name, decrypted_file_name, key);
+			});
+
+			run_benchmark(report, "map_data_files", bytes, key.length(), [&]()
+			{
+				map_data_files(input_file_name, encrypted_file_name, decrypted_file_name, key);
+			});
+		}
+		catch (const std::bad_alloc&)
+		{
+			report << "{\"bytes\":" << bytes << ",\"skipped\":\"out of memory\"}" << std::endl;
+		}
+	}
+
+	std::remove(input_file_name.c_str());
+	std::remove(encrypted_file_name.c_str());
+	std::remove(decrypted_file_name.c_str());
 }
 
-int main()
+/// <summary>
+/// read a whole command line argument as a number. std::stoull throws on a typo and takes -1 as a
+/// huge number, this refuses both
+/// </summary>
+/// <param name="text">argument text</param>
+/// <param name="value">set to the number</param>
+/// <returns>true if the argument is a number and nothing else</returns>
+template <typename T>
+bool parse_number(const char* text, T& value)
+{
+	const char* end = text + std::strlen(text);
+	const auto parsed = std::from_chars(text, end, value);
+	return parsed.ec == std::errc() && parsed.ptr == end;
+}
+
+int main(int argc, char* argv[])
 {
-	std::cout << "Encyption Decryption Test!" << std::endl;
+	// optional mode switch, no arguments runs the original whole-file test
+	const std::string mode = argc > 1 ? argv[1] : "";
+
+	// a benchmark without a report file writes JSON lines to stdout, keep the banner out of them
+	const bool report_to_stdout = mode == "--benchmark" && argc <= 3;
+	(report_to_stdout ? std::cerr : std::cout) << "Encyption Decryption Test!" << std::endl;
 
 	// input file format
 	// Line 1: <students name>
@@ -113,23 +2224,116 @@ int main()
 	const std::string file_name = "inputdatafile.txt";
 	const std::string encrypted_file_name = "encrypteddatafile.txt";
 	const std::string decrypted_file_name = "decrytpteddatafile.txt";
-	const std::string source_string = read_file(file_name);
 	const std::string key = "password";
+	// ChaCha20 needs a 32 byte key and a 12 byte nonce, a fixed pair is fine for this test only
+	const std::string chacha20_demo_key = "pirate ipsum key - 32 bytes long";
+	const std::string chacha20_demo_nonce = "test nonce 1";
+
+	if (mode == "--benchmark")
+	{ // --benchmark [max payload bytes] [report file], JSON lines to stdout if no report file
+		size_t max_bytes = static_cast<size_t>(4ull * 1024 * 1024 * 1024);
+		if (argc > 2 && !parse_number(argv[2], max_bytes))
+		{
+			std::cerr << "Usage: " << argv[0] << " --benchmark [max payload bytes] [report file]" << std::endl;
+			return EXIT_FAILURE;
+		}
+		if (argc > 3)
+		{
+			std::ofstream report_stream(argv[3]);
+			run_benchmarks(report_stream, max_bytes);
+		}
+		else
+		{
+			run_benchmarks(std::cout, max_bytes);
+		}
+		return 0;
+	}
+
+	if (mode == "--batch")
+	{ // --batch <input directory or file list> <output directory> [threads]
+		unsigned thread_count = 0;
+		if (argc < 4 || (argc > 4 && !parse_number(argv[4], thread_count)))
+		{
+			std::cerr << "Usage: " << argv[0] << " --batch <input directory or file list> <output directory> [threads]" << std::endl;
+			return EXIT_FAILURE;
+		}
+		return encrypt_batch(argv[2], argv[3], key, thread_count) ? 0 : EXIT_FAILURE;
+	}
+
+	if (mode == "--container")
+	{ // --container [offset] [length], write the seekable container then decrypt a range of it back
+		uint64_t offset = 0;
+		size_t length = SIZE_MAX;
+		if ((argc > 2 && !parse_number(argv[2], offset)) || (argc > 3 && !parse_number(argv[3], length)))
+		{
+			std::cerr << "Usage: " << argv[0] << " --container [offset] [length]" << std::endl;
+			return EXIT_FAILURE;
+		}
+
+		const std::string container_file_name = "encrypteddatafile.xorc";
+		if (!write_container(file_name, container_file_name, key))
+		{
+			return EXIT_FAILURE;
+		}
+		std::string decrypted_range;
+		if (!read_container_range(container_file_name, key, offset, length, decrypted_range))
+		{
+			return EXIT_FAILURE;
+		}
+
+		std::ifstream container_stream(container_file_name, std::ios::binary);
+		container_header header;
+		read_container_header(container_stream, header);
+		save_data_file(decrypted_file_name, header.student_name, key, decrypted_range);
+
+		std::cout << "Read File: " << file_name << " - Encrypted To: " << container_file_name << " - Decrypted " << decrypted_range.length() << " bytes from " << offset << " To: " << decrypted_file_name << std::endl;
+		return 0;
+	}
+
+	if (mode == "--stream")
+	{ // fixed memory, block at a time
+		const size_t bytes = stream_data_files(file_name, encrypted_file_name, decrypted_file_name, key);
+		std::cout << "Streamed " << bytes << " bytes. Read File: " << file_name << " - Encrypted To: " << encrypted_file_name << " - Decrypted To: " << decrypted_file_name << std::endl;
+		return 0;
+	}
+
+	if (mode == "--mmap")
+	{ // zero copy through memory mapped files
+		const size_t bytes = map_data_files(file_name, encrypted_file_name, decrypted_file_name, key);
+		std::cout << "Mapped " << bytes << " bytes. Read File: " << file_name << " - Encrypted To: " << encrypted_file_name << " - Decrypted To: " << decrypted_file_name << std::endl;
+		return 0;
+	}
+
+	const std::string source_string = read_file(file_name);
 
 	// get the student name from the data file
 	const std::string student_name = get_student_name(source_string);
 
+	// --parallel runs the same test with the transform spread across every core
+	const bool parallel = mode == "--parallel";
+
+	// --chacha20 runs the same test through the ChaCha20 keystream instead of the repeating key
+	const bool chacha20 = mode == "--chacha20";
+	const chacha20_key stream_key = make_chacha20_key(chacha20_demo_key, chacha20_demo_nonce);
+	const std::string& saved_key = chacha20 ? chacha20_demo_key : key;
+	auto transform = [&](const std::string& data)
+	{
+		if (chacha20) return encrypt_decrypt(data, stream_key);
+		if (parallel) return encrypt_decrypt_parallel(data, key);
+		return encrypt_decrypt(data, key);
+	};
+
 	// encrypt sourceString with key
-	const std::string encrypted_string = encrypt_decrypt(source_string, key);
+	const std::string encrypted_string = transform(source_string);
 
 	// save encrypted_string to file
-	save_data_file(encrypted_file_name, student_name, key, encrypted_string);
+	save_data_file(encrypted_file_name, student_name, saved_key, encrypted_string);
 
 	// decrypt encryptedString with key
-	const std::string decrypted_string = encrypt_decrypt(encrypted_string, key);
+	const std::string decrypted_string = transform(encrypted_string);
 
 	// save decrypted_string to file
-	save_data_file(decrypted_file_name, student_name, key, decrypted_string);
+	save_data_file(decrypted_file_name, student_name, saved_key, decrypted_string);
 
 	std::cout << "Read File: " << file_name << " - Encrypted To: " << encrypted_file_name << " - Decrypted To: " << decrypted_file_name << std::endl;
 